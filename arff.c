@@ -78,11 +78,26 @@ static special_token_t special[] = {
 
 static parse_state_t state;
 static attr_info_t *first_attr;
+static attr_info_t *last_attr;
 static instance_t *first_inst;
+static instance_t *last_inst;
 static attr_info_t *curr_attr;
 static instance_t *curr_instance;
 static int curr_data;
+static int curr_row;
+static int in_row;
+static int skip_row;
+static int inst_map_size;
 static char *class_name;
+static arff_filter_t *filter;
+static instance_t taken;	/* the row being read, with take_row */
+
+/* Per attribute declared in the file: the attribute if its column is kept,
+ * else NULL, and its slot in an instance's data.
+ */
+static int num_columns;
+static attr_info_t **columns;
+static int *column_slot;
 
 static char error_string[200];
 static int line_no;
@@ -125,8 +140,10 @@ static int lex (char *buf, arff_info_t * info);
 static char *read_token (char **pbuf, token_t * delimiter);
 static int stricmp (const char *x, const char *y);
 static attr_info_t *add_attribute (arff_info_t * info, char *name);
+static void release_attribute (attr_info_t * attr);
 static void add_nominal_class (nom_info_t * info, char *name);
 static instance_t *add_instance (arff_info_t * info);
+static void add_instance_index (arff_info_t * info, int index);
 
 /* parser tables */
 parse_state_t parse_relation1 (token_t token, char *name, arff_info_t * info);
@@ -138,13 +155,15 @@ parse_state_t parse_attribute2_nominal (token_t token, char *name,
 					arff_info_t * info);
 parse_state_t parse_attribute_nom1 (token_t token, char *name,
 				    arff_info_t * info);
+parse_state_t parse_data_begin (token_t token, char *name,
+				arff_info_t * info);
 parse_state_t parse_data (token_t token, char *name, arff_info_t * info);
 parse_state_t parse_data_end (token_t token, char *name, arff_info_t * info);
 
 static parse_table_t parse_newline_tab[] = {
 	{TOKEN_RELATION, NULL, PARSE_STATE_RELATION1},
 	{TOKEN_ATTRIBUTE, NULL, PARSE_STATE_ATTRIBUTE1},
-	{TOKEN_DATA, NULL, PARSE_STATE_DATA1},
+	{TOKEN_DATA, parse_data_begin},
 	{TOKEN_NEWLINE, NULL, PARSE_STATE_NEWLINE},
 	{TOKEN_NUM_TYPES, NULL, 0}
 };
@@ -213,28 +232,49 @@ static parse_table_t *parse_table[PARSE_STATE_NUM] = {
 
 /* functions */
 arff_info_t *read_arff (char *filename, char *class_attribute_name)
+{
+	return read_arff_filtered (filename, class_attribute_name, NULL);
+}
+
+/* Read an ARFF file, keeping only the columns selected by the filter (all of
+ * them if it is NULL).  The file is lexed a line at a time, so the text is
+ * never resident as a whole, and dropped columns are skipped without being
+ * converted.
+ */
+arff_info_t *read_arff_filtered (char *filename, char *class_attribute_name,
+				 arff_filter_t * keep)
 {
 	arff_info_t *info = init (class_attribute_name);
 	FILE *in;
-	int size;
-	char *buf;
+	size_t size = 0;
+	char *buf = NULL;
+
+	filter = keep;
 
 	if (!(in = fopen (filename, "r"))) {
 		sprintf (error_string, "unable to open file: %s", filename);
 	} else {
-		fseek (in, 0, SEEK_END);
-		size = ftell (in);
-		buf = (char *) malloc_dbg (25, size + 1);
-		fseek (in, 0, SEEK_SET);
-		size = fread (buf, 1, size, in);
-
-		if (FAIL (lex (buf, info))) {
-			release_read_info (info);
-			info = NULL;
+		while (getline (&buf, &size, in) != -1) {
+			if (FAIL (lex (buf, info))) {
+				release_read_info (info);
+				info = NULL;
+				break;
+			}
 		}
+		if (info != NULL)
+			parse_end (info);
 
 		free (buf);
+		fclose (in);
 	}
+
+	free (columns);
+	free (column_slot);
+	free (taken.data);
+	columns = NULL;
+	column_slot = NULL;
+	taken.data = NULL;
+
 	return info;
 }
 
@@ -307,37 +347,45 @@ void write_arff (arff_info_t * info, FILE * out)
 	fflush (out);
 }
 
+void release_attribute (attr_info_t * attr)
+{
+	nom_val_t *nom_val, *next_nom_val;
+
+	free (attr->name);
+	if (attr->type == ATTR_NOMINAL) {
+		for (nom_val = attr->nom_info->first; nom_val != NULL;
+		     nom_val = next_nom_val) {
+			free (nom_val->name);
+			next_nom_val = nom_val->next;
+			free (nom_val);
+		}
+		free (attr->nom_info);
+	}
+	free (attr);
+}
+
 void release_read_info (arff_info_t * info)
 {
 	int i;
-	nom_val_t *nom_val, *next_nom_val;
 
 	free (info->relation_name);
 	if (info->attributes != NULL) {
-		for (i = 0; i < info->num_attributes; i++) {
-			free (info->attributes[i]->name);
-			if (info->attributes[i]->type == ATTR_NOMINAL) {
-				for (nom_val =
-				     info->attributes[i]->nom_info->first;
-				     nom_val != NULL;
-				     nom_val = next_nom_val) {
-					free (nom_val->name);
-					next_nom_val = nom_val->next;
-					free (nom_val);
-				}
-				free (info->attributes[i]->nom_info);
-			}
-			free (info->attributes[i]);
-		}
+		for (i = 0; i < info->num_attributes; i++)
+			release_attribute (info->attributes[i]);
 		free (info->attributes);
 	}
+	free (info->attr_map);
+	free (info->inst_map);
 	if (info->instances != NULL) {
 		for (i = 0; i < info->num_instances; i++) {
-			free (info->instances[i]->data);
+			if (info->block == NULL)
+				free (info->instances[i]->data);
 			free (info->instances[i]);
 		}
 		free (info->instances);
 	}
+	if (info->block_owned)
+		free (info->block);
 	free (info);
 }
 
@@ -351,6 +399,201 @@ int get_lineno ()
 	return line_no;
 }
 
+void set_last_error (char *msg, int lineno)
+{
+	strncpy (error_string, msg, sizeof (error_string) - 1);
+	error_string[sizeof (error_string) - 1] = '\0';
+	line_no = lineno;
+}
+
+/* Header serialization.
+ *
+ * The header is everything but the instance data: relation name, attribute
+ * names and types, nominal dictionaries and the table dimensions.  It is
+ * small next to the data, so a flat byte buffer of ints and NUL-terminated
+ * strings is good enough to ship between processes.
+ */
+static size_t put_int (char *buf, size_t pos, int x)
+{
+	if (buf != NULL)
+		memcpy (buf + pos, &x, sizeof (int));
+	return pos + sizeof (int);
+}
+
+static size_t put_str (char *buf, size_t pos, char *str)
+{
+	size_t len = strlen (str) + 1;
+	if (buf != NULL)
+		memcpy (buf + pos, str, len);
+	return pos + len;
+}
+
+static size_t pack_header (arff_info_t * info, char *buf)
+{
+	size_t pos = 0;
+	int i;
+	nom_val_t *nom_val;
+
+	pos = put_str (buf, pos,
+		       info->relation_name ? info->relation_name : "");
+	pos = put_int (buf, pos, info->num_attributes);
+	pos = put_int (buf, pos, info->num_instances);
+	pos = put_int (buf, pos, info->class_index);
+
+	for (i = 0; i < info->num_attributes; i++) {
+		pos = put_str (buf, pos, info->attributes[i]->name);
+		pos = put_int (buf, pos, info->attributes[i]->type);
+		if (info->attributes[i]->type == ATTR_NOMINAL) {
+			pos = put_int (buf, pos,
+				       info->attributes[i]->nom_info->
+				       num_classes);
+			for (nom_val = info->attributes[i]->nom_info->first;
+			     nom_val != NULL; nom_val = nom_val->next)
+				pos = put_str (buf, pos, nom_val->name);
+		}
+	}
+	return pos;
+}
+
+size_t arff_pack_header (arff_info_t * info, char **pbuf)
+{
+	size_t len = pack_header (info, NULL);
+
+	*pbuf = (char *) malloc_dbg (37, len);
+	pack_header (info, *pbuf);
+	return len;
+}
+
+static int get_int (char *buf, size_t * pos)
+{
+	int x;
+	memcpy (&x, buf + *pos, sizeof (int));
+	*pos += sizeof (int);
+	return x;
+}
+
+static char *get_str (char *buf, size_t * pos)
+{
+	char *str = buf + *pos;
+	*pos += strlen (str) + 1;
+	return str;
+}
+
+arff_info_t *arff_unpack_header (char *buf, size_t len)
+{
+	arff_info_t *info = init ("");
+	attr_info_t *attr;
+	size_t pos = 0;
+	char *name;
+	int i, j, n;
+
+	name = get_str (buf, &pos);
+	info->relation_name = (char *) malloc_dbg (27, strlen (name) + 1);
+	strcpy (info->relation_name, name);
+	info->num_attributes = get_int (buf, &pos);
+	info->num_instances = get_int (buf, &pos);
+	info->class_index = get_int (buf, &pos);
+
+	info->attributes =
+		(attr_info_t **) malloc_dbg (29, sizeof (attr_info_t *) *
+					     info->num_attributes);
+	for (i = 0; i < info->num_attributes; i++) {
+		attr = (attr_info_t *) malloc_dbg (31, sizeof (attr_info_t));
+		name = get_str (buf, &pos);
+		attr->name = (char *) malloc_dbg (32, strlen (name) + 1);
+		strcpy (attr->name, name);
+		attr->type = get_int (buf, &pos);
+		attr->nom_info = NULL;
+		attr->next = NULL;
+		if (attr->type == ATTR_NOMINAL) {
+			attr->nom_info =
+				(nom_info_t *) malloc_dbg (28,
+							   sizeof
+							   (nom_info_t));
+			attr->nom_info->num_classes = 0;
+			attr->nom_info->first = NULL;
+			n = get_int (buf, &pos);
+			for (j = 0; j < n; j++)
+				add_nominal_class (attr->nom_info,
+						   get_str (buf, &pos));
+		}
+		if (i > 0)
+			info->attributes[i - 1]->next = attr;
+		info->attributes[i] = attr;
+	}
+
+	if (pos != len) {
+		sprintf (error_string, "corrupt header: %lu of %lu bytes used",
+			 (unsigned long) pos, (unsigned long) len);
+		release_read_info (info);
+		return NULL;
+	}
+
+	return info;
+}
+
+/* Point every instance at its row of a contiguous, row-major block of
+ * num_instances * num_attributes values.  Instances are created if the info
+ * has none yet (as after arff_unpack_header).  The block is not owned.
+ */
+void arff_attach_block (arff_info_t * info, data_t * block)
+{
+	int i;
+
+	if (info->instances == NULL) {
+		info->instances =
+			(instance_t **) malloc_dbg (30,
+						    sizeof (instance_t *) *
+						    info->num_instances);
+		for (i = 0; i < info->num_instances; i++) {
+			info->instances[i] =
+				(instance_t *) malloc_dbg (35,
+							   sizeof
+							   (instance_t));
+			info->instances[i]->next = NULL;
+		}
+	}
+
+	for (i = 0; i < info->num_instances; i++)
+		info->instances[i]->data =
+			block + (size_t) i * info->num_attributes;
+
+	info->block = block;
+	info->block_owned = 0;
+}
+
+/* Move rows [first, first + count) into their place in a contiguous block,
+ * freeing the originals.  The info does not consider the block its own until
+ * arff_compact (or arff_attach_block) is called for it.
+ */
+void arff_compact_rows (arff_info_t * info, data_t * block, int first,
+			int count)
+{
+	int i;
+	size_t row = sizeof (data_t) * info->num_attributes;
+
+	for (i = first; i < first + count; i++) {
+		data_t *data = info->instances[i]->data;
+		data_t *dest = block + (size_t) i * info->num_attributes;
+
+		if (data == dest)
+			continue;
+		memcpy (dest, data, row);
+		if (info->block == NULL)
+			free (data);
+		info->instances[i]->data = dest;
+	}
+}
+
+/* Move per-instance rows into a contiguous block, freeing the rows. */
+void arff_compact (arff_info_t * info, data_t * block)
+{
+	arff_compact_rows (info, block, 0, info->num_instances);
+	if (info->block_owned)
+		free (info->block);
+	arff_attach_block (info, block);
+}
+
 arff_info_t *init (char *class_attribute_name)
 {
 	arff_info_t *info =
@@ -361,11 +604,19 @@ arff_info_t *init (char *class_attribute_name)
 	info->num_instances = 0;
 	info->instances = NULL;
 	info->class_index = -1;
+	info->block = NULL;
+	info->block_owned = 0;
+	info->attr_map = NULL;
 
 	state = PARSE_STATE_NEWLINE;
-	first_attr = NULL;
-	first_inst = NULL;
+	first_attr = last_attr = NULL;
+	first_inst = last_inst = NULL;
+	num_columns = 0;
 	curr_instance = NULL;
+	curr_row = 0;
+	in_row = 0;
+	inst_map_size = 0;
+	info->inst_map = NULL;
 	strcpy (error_string, "");
 	class_name = class_attribute_name;
 	line_no = 1;
@@ -434,8 +685,6 @@ int lex (char *buf, arff_info_t * info)
 		}
 	}
 
-	parse_end (info);
-
 	return 0;
 }
 
@@ -573,24 +822,93 @@ parse_state_t parse_attribute_nom1 (token_t token, char *name,
 	return PARSE_STATE_ATTRIBUTE_NOM2;
 }
 
+/* Fix the set of kept columns once all attributes are declared. */
+parse_state_t parse_data_begin (token_t token, char *name,
+				arff_info_t * info)
+{
+	attr_info_t *attr, *next, *prev = NULL;
+	int i, kept = 0;
+
+	num_columns = info->num_attributes;
+	columns = (attr_info_t **) malloc_dbg (41, sizeof (attr_info_t *) *
+					       num_columns);
+	column_slot = (int *) malloc_dbg (42, sizeof (int) * num_columns);
+
+	for (i = 0, attr = first_attr; attr != NULL; attr = next, i++) {
+		next = attr->next;
+		if ((filter == NULL) || (i == info->class_index)
+		    || (i % filter->attr_stride == filter->attr_offset)) {
+			columns[i] = attr;
+			column_slot[i] = kept++;
+			if (prev == NULL)
+				first_attr = attr;
+			else
+				prev->next = attr;
+			prev = attr;
+		} else {
+			columns[i] = NULL;
+			column_slot[i] = -1;
+			release_attribute (attr);
+		}
+	}
+	if (prev == NULL)
+		first_attr = NULL;
+	else
+		prev->next = NULL;
+	last_attr = prev;
+
+	info->num_attributes = kept;
+	info->attributes =
+		(attr_info_t **) malloc_dbg (29, sizeof (attr_info_t *) *
+					     kept);
+	if (filter != NULL)
+		info->attr_map = (int *) malloc_dbg (43, sizeof (int) * kept);
+
+	for (i = 0; i < num_columns; i++) {
+		if (columns[i] == NULL)
+			continue;
+		info->attributes[column_slot[i]] = columns[i];
+		if (info->attr_map != NULL)
+			info->attr_map[column_slot[i]] = i;
+	}
+	if (info->class_index >= 0)
+		info->class_index = column_slot[info->class_index];
+	if (filter != NULL && filter->take_row != NULL)
+		taken.data = (data_t *) malloc_dbg (98, sizeof (data_t) * kept);
+
+	DEBUGMSG (("  keep %i of %i attributes\n", kept, num_columns));
+
+	return PARSE_STATE_DATA1;
+}
+
 parse_state_t parse_data (token_t token, char *name, arff_info_t * info)
 {
 	nom_val_t *x;
 	parse_state_t r = PARSE_STATE_DATA2;
 
-	if (curr_instance == NULL) {
-		curr_instance = add_instance (info);
+	if (!in_row) {
+		in_row = 1;
 		curr_data = 0;
-		curr_attr = first_attr;
+		skip_row = (filter != NULL) && (filter->keep_instance != NULL)
+			&& !filter->keep_instance (curr_row, filter->arg);
+		if (!skip_row && filter != NULL && filter->take_row != NULL) {
+			curr_instance = &taken;
+		} else if (!skip_row) {
+			curr_instance = add_instance (info);
+			if (filter != NULL && filter->keep_instance != NULL)
+				add_instance_index (info, curr_row);
+		}
 	}
 
-	if (curr_attr == NULL) {
+	if (curr_data >= num_columns) {
 		sprintf (error_string, "too many data values given");
 		r = PARSE_STATE_ERROR;
 	} else {
-		switch (curr_attr->type) {
+		curr_attr = skip_row ? NULL : columns[curr_data];
+		switch (curr_attr == NULL ? ATTR_NUM_TYPES : curr_attr->type) {
 		case ATTR_NUMERIC:
-			curr_instance->data[curr_data++].fval = atof (name);
+			curr_instance->data[column_slot[curr_data]].fval =
+				atof (name);
 			DEBUGMSG (("  add numeric data, val = %f\n",
 				   atof (name)));
 			break;
@@ -599,7 +917,8 @@ parse_state_t parse_data (token_t token, char *name, arff_info_t * info)
 			for (x = curr_attr->nom_info->first; x != NULL;
 			     x = x->next) {
 				if (!strcmp (name, x->name)) {
-					curr_instance->data[curr_data++].
+					curr_instance->data[column_slot
+							    [curr_data]].
 						ival = x->val;
 					DEBUGMSG (("  add nominal data, val = %s, index = %i\n", x->name, x->val));
 					break;
@@ -616,7 +935,7 @@ parse_state_t parse_data (token_t token, char *name, arff_info_t * info)
 			break;
 		}
 
-		curr_attr = curr_attr->next;
+		curr_data++;
 	}
 
 	return r;
@@ -625,11 +944,16 @@ parse_state_t parse_data (token_t token, char *name, arff_info_t * info)
 parse_state_t parse_data_end (token_t token, char *name, arff_info_t * info)
 {
 	parse_state_t r = PARSE_STATE_DATA1;
-	if (curr_data != info->num_attributes) {
+	if (curr_data != num_columns) {
 		sprintf (error_string, "not enough data values given");
 		r = PARSE_STATE_ERROR;
+	} else if (!skip_row && curr_instance == &taken) {
+		filter->take_row (curr_row, taken.data, info->num_attributes,
+				  filter->arg);
 	}
 	curr_instance = NULL;
+	in_row = 0;
+	curr_row++;
 	return r;
 }
 
@@ -638,12 +962,17 @@ void parse_end (arff_info_t * info)
 	int i;
 	attr_info_t *attr_info;
 	instance_t *instance;
-	info->attributes =
-		(attr_info_t **) malloc_dbg (29, sizeof (attr_info_t *) *
-					     info->num_attributes);
-	for (i = 0, attr_info = first_attr; attr_info != NULL;
-	     attr_info = attr_info->next, i++) {
-		info->attributes[i] = attr_info;
+
+	/* Without a data section, no column was dropped */
+	if (info->attributes == NULL) {
+		info->attributes =
+			(attr_info_t **) malloc_dbg (29,
+						     sizeof (attr_info_t *) *
+						     info->num_attributes);
+		for (i = 0, attr_info = first_attr; attr_info != NULL;
+		     attr_info = attr_info->next, i++) {
+			info->attributes[i] = attr_info;
+		}
 	}
 	info->instances =
 		(instance_t **) malloc_dbg (30, sizeof (instance_t *) *
@@ -657,7 +986,7 @@ void parse_end (arff_info_t * info)
 attr_info_t *add_attribute (arff_info_t * info, char *name)
 {
 	attr_info_t *r =
-		(attr_info_t *) malloc_dbg (31, sizeof (attr_info_t)), *x;
+		(attr_info_t *) malloc_dbg (31, sizeof (attr_info_t));
 
 	r->name = (char *) malloc_dbg (32, strlen (name) + 1);
 	strcpy (r->name, name);
@@ -668,9 +997,9 @@ attr_info_t *add_attribute (arff_info_t * info, char *name)
 	if (first_attr == NULL) {
 		first_attr = r;
 	} else {
-		for (x = first_attr; x->next != NULL; x = x->next);
-		x->next = r;
+		last_attr->next = r;
 	}
+	last_attr = r;
 
 	if (!stricmp (name, class_name)) {
 		info->class_index = info->num_attributes;
@@ -705,7 +1034,7 @@ void add_nominal_class (nom_info_t * info, char *name)
 instance_t *add_instance (arff_info_t * info)
 {
 	instance_t *r =
-		(instance_t *) malloc_dbg (35, sizeof (instance_t)), *x;
+		(instance_t *) malloc_dbg (35, sizeof (instance_t));
 	r->data =
 		(data_t *) malloc_dbg (36,
 				       sizeof (data_t) *
@@ -715,9 +1044,9 @@ instance_t *add_instance (arff_info_t * info)
 	if (first_inst == NULL) {
 		first_inst = r;
 	} else {
-		for (x = first_inst; x->next != NULL; x = x->next);
-		x->next = r;
+		last_inst->next = r;
 	}
+	last_inst = r;
 	info->num_instances++;
 
 	DEBUGMSG (("  create instance, total = %i\n", info->num_instances));
@@ -725,6 +1054,17 @@ instance_t *add_instance (arff_info_t * info)
 	return r;
 }
 
+void add_instance_index (arff_info_t * info, int index)
+{
+	if (info->num_instances > inst_map_size) {
+		inst_map_size = inst_map_size ? 2 * inst_map_size : 1024;
+		info->inst_map =
+			(int *) realloc (info->inst_map,
+					 sizeof (int) * inst_map_size);
+	}
+	info->inst_map[info->num_instances - 1] = index;
+}
+
 #ifdef ARFF_DEBUG_MAIN
 void print_arff_info (arff_info_t * info)
 {
@@ -28,7 +28,6 @@ typedef struct _attr_info_t {
 typedef union {
 	float fval;
 	int ival;
-	char *sval;
 } data_t;
 
 typedef struct _instance_t {
@@ -43,12 +42,39 @@ typedef struct {
 	int num_instances;
 	instance_t **instances;
 	int class_index;
+	data_t *block;		/* contiguous instance rows, or NULL */
+	int block_owned;	/* free block on release */
+	int *attr_map;		/* file index of each attribute, if filtered */
+	int *inst_map;		/* file index of each instance, if filtered */
 } arff_info_t;
 
+/* Keeps every attr_stride-th attribute, starting at attr_offset, and the
+ * class attribute; and the instances keep_instance accepts, if given.  With
+ * take_row, each kept row is handed to it as soon as it is read instead of
+ * becoming an instance, so the info ends up with none.
+ */
+typedef struct {
+	int attr_stride;
+	int attr_offset;
+	int (*keep_instance) (int index, void *arg);
+	void (*take_row) (int index, data_t * row, int length, void *arg);
+	void *arg;
+} arff_filter_t;
+
 arff_info_t *read_arff (char *filename, char *class_attribute_name);
+arff_info_t *read_arff_filtered (char *filename, char *class_attribute_name,
+				 arff_filter_t * keep);
 void write_arff (arff_info_t * info, FILE * out);
 void release_read_info (arff_info_t * info);
 char *get_last_error ();
 int get_lineno ();
+void set_last_error (char *msg, int lineno);
+
+size_t arff_pack_header (arff_info_t * info, char **pbuf);
+arff_info_t *arff_unpack_header (char *buf, size_t len);
+void arff_attach_block (arff_info_t * info, data_t * block);
+void arff_compact_rows (arff_info_t * info, data_t * block, int first,
+			int count);
+void arff_compact (arff_info_t * info, data_t * block);
 
 #endif
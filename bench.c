@@ -0,0 +1,396 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <argp.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "arff.h"
+#include "prelieff.h"
+#include "index_sort.h"
+#include "metrics.h"
+#include "rng.h"
+#include "util.h"
+#ifndef NO_MPI
+#include "mpi.h"
+#endif
+
+/* prelieff-bench - the throughput of the hot paths on one data set (see
+ * gendata): reading it, single distances, neighbour searches, weight
+ * updates and sorting, then whole builds.  Each benchmark runs a few times
+ * unmeasured to warm up, then is measured over repetitions, and its mean
+ * is set against the baseline of the same name, if there is one.
+ */
+
+const char *argp_program_version = "prelieff-bench 0.2";
+const char *argp_program_bug_address = "<chris-johnson@utulsa.edu>";
+
+static char doc[] = "prelieff-bench - benchmarks of prelieff's hot paths";
+
+static char args_doc[] = "ARFF_FILE";
+
+/* Internals of prelieff.c, not in its header */
+void initEvaluator (arff_info_t * data, double *weights);
+void releaseEvaluator ();
+double distance (instance_t * first, instance_t * second);
+void clearKHitMiss ();
+void findKHitMiss (int instNum);
+void updateWeightsDiscreteClass (int instNum);
+
+static struct argp_option options[] = {
+	{"class", 'c', "NAME", 0,
+	 "Class attribute name (Default: \"Class\")"},
+	{"repetitions", 'n', "NUM", 0,
+	 "Measured runs of each benchmark (Default: 5)"},
+	{"warmup", 'w', "NUM", 0,
+	 "Unmeasured runs before them (Default: 1)"},
+	{"queries", 'm', "NUM", 0,
+	 "Instances searched and updated per run, and sampled per build (Default: 256)"},
+	{"knn", 'k', "NUM", 0, "Number of neighbours (Default: 10)"},
+	{"baseline", 'B', "FILE", 0, "Compare with the baselines in FILE"},
+	{"save", 'o', "FILE", 0, "Write the results to FILE as baselines"},
+	{"tolerance", 't', "PERCENT", 0,
+	 "Change from the baseline that counts as one (Default: 10)"},
+	{0}
+};
+
+struct arguments {
+	char *arff;
+	char *class;
+	char *baseline;
+	char *save;
+	int repetitions, warmup, queries, knn;
+	double tolerance;
+};
+
+static error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+
+	switch (key) {
+	case 'c':
+		arguments->class = arg;
+		break;
+	case 'n':
+		arguments->repetitions = atoi (arg);
+		break;
+	case 'w':
+		arguments->warmup = atoi (arg);
+		break;
+	case 'm':
+		arguments->queries = atoi (arg);
+		break;
+	case 'k':
+		arguments->knn = atoi (arg);
+		break;
+	case 'B':
+		arguments->baseline = arg;
+		break;
+	case 'o':
+		arguments->save = arg;
+		break;
+	case 't':
+		arguments->tolerance = atof (arg);
+		break;
+
+	case ARGP_KEY_ARG:
+		if (state->arg_num >= 1)
+			argp_usage (state);
+
+		arguments->arff = arg;
+		break;
+
+	case ARGP_KEY_END:
+		if (state->arg_num < 1)
+			argp_usage (state);
+
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+/* A benchmark: one run does some units of work and returns how many,
+ * having added the seconds they took to *seconds (so a run can leave its
+ * own setup out of the measurement).
+ */
+typedef struct {
+	char *name;		/* as in the baseline file */
+	char *unit;		/* what the throughput counts, per second */
+	double (*run) (double *seconds);
+	int evaluator;		/* needs the state initEvaluator sets up */
+} bench_t;
+
+/* What the runs share */
+static struct arguments *m_args;
+static int m_rank;
+static arff_info_t *m_data;
+static double *m_weights;
+static double m_fileSize;
+static volatile double m_sink;	/* keeps results the compiler could drop */
+
+static double run_read (double *seconds)
+{
+	arff_info_t *info;
+	double t = metrics_now ();
+
+	info = read_arff (m_args->arff, m_args->class);
+	*seconds += metrics_now () - t;
+	if (info == NULL) {
+		fprintf (stderr, "%s: %s\n", m_args->arff, get_last_error ());
+		exit (1);
+	}
+	release_read_info (info);
+	return m_fileSize / 1e6;
+}
+
+/* Pairs spread over the data, a few per instance */
+static double run_distance (double *seconds)
+{
+	instance_t **inst = m_data->instances;
+	int n = m_data->num_instances, pairs = 16 * n, i;
+	double t = metrics_now (), d = 0;
+
+	for (i = 0; i < pairs; i++)
+		d += distance (inst[i % n], inst[(int)
+						 (((long) i * 7919 + 1) % n)]);
+	*seconds += metrics_now () - t;
+	m_sink = d;
+	return pairs;
+}
+
+static double run_search (double *seconds)
+{
+	int i, q = m_args->queries;
+	double t = metrics_now ();
+
+	for (i = 0; i < q; i++) {
+		clearKHitMiss ();
+		findKHitMiss (i % m_data->num_instances);
+	}
+	*seconds += metrics_now () - t;
+	return q;
+}
+
+/* The updates alone; each query's search is left out */
+static double run_update (double *seconds)
+{
+	int i, q = m_args->queries;
+	double t;
+
+	for (i = 0; i < q; i++) {
+		clearKHitMiss ();
+		findKHitMiss (i % m_data->num_instances);
+		t = metrics_now ();
+		updateWeightsDiscreteClass (i % m_data->num_instances);
+		*seconds += metrics_now () - t;
+	}
+	return q;
+}
+
+/* Attribute-length keys, as for ranking, sorted often enough to measure */
+static double run_sort (double *seconds)
+{
+	int n = m_data->num_attributes, times = 1 + (1 << 20) / n, i, r;
+	int *index = (int *) malloc_dbg (158, sizeof (int) * n);
+	double *x = (double *) malloc_dbg (159, sizeof (double) * n);
+	uint64_t key = rng_key (1);
+	double t;
+
+	for (r = 0; r < times; r++) {
+		for (i = 0; i < n; i++)
+			x[i] = rng_uniform (key, r, i);
+		t = metrics_now ();
+		index_sort (index, x, n);
+		*seconds += metrics_now () - t;
+	}
+	free (index);
+	free (x);
+	return (double) n * times;
+}
+
+static double run_build (double *seconds)
+{
+	double t = metrics_now ();
+
+	buildEvaluator (m_data, m_weights);
+	*seconds += metrics_now () - t;
+	return m_args->queries;
+}
+
+/* In the order they run: the whole build last, as it sets up the
+ * evaluator's state for itself
+ */
+static bench_t m_benchmarks[] = {
+	{"read_arff", "MB", run_read, 0},
+	{"distance", "distances", run_distance, 1},
+	{"findKHitMiss", "queries", run_search, 1},
+	{"updateWeightsDiscreteClass", "queries", run_update, 1},
+	{"index_sort", "elements", run_sort, 0},
+	{"buildEvaluator", "queries", run_build, 0},
+};
+
+#define NUM_BENCHMARKS	(int) (sizeof (m_benchmarks) / sizeof (bench_t))
+
+/* A baseline's mean throughput, or 0 if it has none */
+static double baseline_of (char *filename, char *name)
+{
+	char line[256], key[128];
+	double value, found = 0;
+	FILE *fp;
+
+	if (filename == NULL || (fp = fopen (filename, "r")) == NULL)
+		return 0;
+	while (fgets (line, sizeof (line), fp) != NULL) {
+		if (line[0] != '#'
+		    && sscanf (line, "%127s %lf", key, &value) == 2
+		    && strcmp (key, name) == 0)
+			found = value;
+	}
+	fclose (fp);
+	return found;
+}
+
+/* Warms up, measures and reports a benchmark on rank 0 */
+static void measure (bench_t * b, FILE * save)
+{
+	double *rates;
+	double seconds, units, mean = 0, var = 0, base, change;
+	int r, n = m_args->repetitions;
+
+	rates = (double *) malloc_dbg (161, sizeof (double) * n);
+	for (r = 0; r < m_args->warmup; r++) {
+		seconds = 0;
+		b->run (&seconds);
+	}
+	for (r = 0; r < n; r++) {
+		seconds = 0;
+		units = b->run (&seconds);
+		rates[r] = (seconds > 0) ? units / seconds : 0;
+		mean += rates[r] / n;
+	}
+	for (r = 0; r < n; r++)
+		var += (rates[r] - mean) * (rates[r] - mean);
+	var = (n > 1) ? var / (n - 1) : 0;
+	free (rates);
+	if (m_rank != 0)
+		return;
+
+	printf ("%-28s %12.4g %-12s +/- %5.1f%%", b->name, mean, b->unit,
+		(mean > 0) ? 100 * sqrt (var) / mean : 0);
+	base = baseline_of (m_args->baseline, b->name);
+	if (base > 0) {
+		change = 100 * (mean - base) / base;
+		printf ("  %12.4g  %+6.1f%%%s", base, change,
+			(change < -m_args->tolerance) ? "  slower" :
+			(change > m_args->tolerance) ? "  faster" : "");
+	}
+	printf ("\n");
+	fflush (stdout);
+	if (save != NULL)
+		fprintf (save, "%s %.6g\n", b->name, mean);
+}
+
+int main (int argc, char **argv)
+{
+	struct arguments arguments;
+	struct stat st;
+	FILE *save = NULL;
+	int i, ready = false;
+
+	arguments.arff = NULL;
+	arguments.class = "Class";	// Default class name
+	arguments.baseline = NULL;	// Report no changes by default
+	arguments.save = NULL;
+	arguments.repetitions = 5;
+	arguments.warmup = 1;
+	arguments.queries = 256;
+	arguments.knn = 10;
+	arguments.tolerance = 10;
+
+	if (argp_parse (&argp, argc, argv, 0, 0, &arguments))
+		return 1;
+
+	if (arguments.repetitions < 1 || arguments.warmup < 0
+	    || arguments.queries < 1 || arguments.knn < 1) {
+		fprintf (stderr,
+			 "--repetitions, --queries and --knn must be positive, --warmup not negative\n");
+		return 1;
+	}
+	m_args = &arguments;
+
+#ifdef NO_MPI
+	m_rank = 0;
+#else
+	MPI_Init (&argc, &argv);
+	MPI_Comm_rank (MPI_COMM_WORLD, &m_rank);
+#endif
+
+	if (stat (arguments.arff, &st) != 0 || (m_data = read_arff
+						  (arguments.arff,
+						   arguments.class)) ==
+	    NULL) {
+		fprintf (stderr, "Could not read %s: %s\n", arguments.arff,
+			 get_last_error ());
+		return 1;
+	}
+	m_fileSize = st.st_size;
+	if (m_rank == 0 && arguments.save != NULL) {
+		save = fopen (arguments.save, "w");
+		if (save == NULL) {
+			fprintf (stderr,
+				 "Could not open file for writing: %s\n",
+				 arguments.save);
+			return 1;
+		}
+		fprintf (save, "# %s: %d instances, %d attributes\n",
+			 arguments.arff, m_data->num_instances,
+			 m_data->num_attributes);
+	}
+
+	/* Every rank runs the others' benchmarks too, but only rank 0
+	 * reports them; the builds are shared out as usual.
+	 */
+	if (m_rank == 0) {
+		printf ("%s: %d instances, %d attributes, %d repetitions after %d warm-up\n",
+			arguments.arff, m_data->num_instances,
+			m_data->num_attributes, arguments.repetitions,
+			arguments.warmup);
+		printf ("%-28s %12s %-12s %10s", "benchmark", "per second",
+			"", "spread");
+		if (arguments.baseline != NULL)
+			printf ("  %12s  %7s", "baseline", "change");
+		printf ("\n");
+	}
+
+	resetOptions ();
+	setNumNeighbours (arguments.knn);
+	setSampleSize (arguments.queries);
+	m_weights = (double *) malloc_dbg (160, sizeof (double) *
+					   m_data->num_attributes);
+
+	for (i = 0; i < NUM_BENCHMARKS; i++) {
+		if (m_benchmarks[i].evaluator && !ready)
+			initEvaluator (m_data, m_weights);
+		else if (!m_benchmarks[i].evaluator && ready)
+			releaseEvaluator ();
+		ready = m_benchmarks[i].evaluator;
+		measure (&m_benchmarks[i], save);
+	}
+
+	if (save != NULL && fclose (save) != 0) {
+		fprintf (stderr, "Could not write file: %s\n", arguments.save);
+		return 1;
+	}
+	free (m_weights);
+	release_read_info (m_data);
+
+#ifndef NO_MPI
+	MPI_Finalize ();
+#endif
+	return 0;
+}
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arff.h"
+#include "dcache.h"
+#include "util.h"
+
+/* A cache file is a small header followed by the row of every instance, in
+ * instance order, as in memory.  Like a state file it is meant to be read
+ * back by the same build on the same kind of machine.  The header is marked
+ * complete only once every row is in, so a cache left behind by a failed
+ * run is never used.
+ */
+
+#define DCACHE_MAGIC	0x48434344	/* "DCCH" */
+#define DCACHE_VERSION	1
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;		/* see dcache_key */
+	int32_t instances;
+	int32_t complete;
+} dcache_header_t;
+
+/**
+ * Allocates a cache for the rows of every stride-th of instances, starting
+ * at first.  Returns NULL, with the error set (see get_last_error), if it
+ * does not fit in memory.
+ */
+dist_cache_t *dcache_create (int first, int stride, int instances)
+{
+	dist_cache_t *cache;
+	size_t rows = (instances - first + stride - 1) / stride;
+	size_t cols = (instances > 0) ? instances - 1 : 0;
+
+	if (cols > 0 && rows > SIZE_MAX / sizeof (dcache_entry_t) / cols) {
+		set_last_error ("Distance cache too large for memory", 0);
+		return NULL;
+	}
+	cache = (dist_cache_t *) malloc_dbg (77, sizeof (dist_cache_t));
+	cache->rows = rows;
+	cache->cols = cols;
+	cache->first = first;
+	cache->stride = stride;
+	cache->pitch = cache->cols;
+	cache->entries = (dcache_entry_t *) malloc_dbg (79,
+							sizeof
+							(dcache_entry_t) *
+							rows * cols);
+	cache->map = NULL;
+	cache->map_size = 0;
+	if (cache->entries == NULL && rows * cols > 0) {
+		free (cache);
+		set_last_error ("Distance cache too large for memory", 0);
+		return NULL;
+	}
+	return cache;
+}
+
+dcache_entry_t *dcache_row (dist_cache_t * cache, int row)
+{
+	return cache->entries + (size_t) row * cache->pitch;
+}
+
+/* The instance index of a row's query */
+int dcache_query (dist_cache_t * cache, int row)
+{
+	return cache->first + row * cache->stride;
+}
+
+/* Nearest first, equal distances by index, as neighbours are chosen */
+static int compentry (const void *p1, const void *p2)
+{
+	const dcache_entry_t *a = (const dcache_entry_t *) p1;
+	const dcache_entry_t *b = (const dcache_entry_t *) p2;
+
+	if (a->dist != b->dist)
+		return (a->dist < b->dist) ? -1 : 1;
+	return (a->index < b->index) ? -1 : (a->index > b->index);
+}
+
+void dcache_sort_row (dist_cache_t * cache, int row)
+{
+	qsort (dcache_row (cache, row), cache->cols, sizeof (dcache_entry_t),
+	       compentry);
+}
+
+void dcache_release (dist_cache_t * cache)
+{
+	if (cache == NULL)
+		return;
+
+	if (cache->map != NULL)
+		munmap (cache->map, cache->map_size);
+	else
+		free (cache->entries);
+	free (cache);
+}
+
+/* Folds an int into an FNV-1a hash */
+static uint64_t fold (uint64_t hash, int value)
+{
+	unsigned char *p = (unsigned char *) &value;
+	size_t i;
+
+	for (i = 0; i < sizeof (int); i++) {
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+ * The key of a cache: what its distances depend on, which is the data (by
+ * state_checksum), the class attribute, the difference metric and the
+ * attributes in use.
+ */
+uint64_t dcache_key (uint64_t checksum, int class_index, int difference,
+		     int *attributes, int count)
+{
+	uint64_t hash = fold (fold (checksum, class_index), difference);
+	int i;
+
+	hash = fold (hash, count);
+	for (i = 0; i < count; i++) {
+		hash = fold (hash, attributes[i]);
+	}
+	return hash;
+}
+
+/**
+ * Maps a complete cache file with the given key and number of instances,
+ * as a view of every stride-th row starting at first.  Returns NULL if
+ * there is no such file.
+ */
+dist_cache_t *dcache_map (char *path, uint64_t key, int instances,
+			  int first, int stride)
+{
+	dcache_header_t header;
+	dist_cache_t *cache;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	size = sizeof (dcache_header_t) + sizeof (dcache_entry_t) *
+		(size_t) instances *(instances - 1);
+	if (pread (fd, &header, sizeof (header), 0) != sizeof (header)
+	    || header.magic != DCACHE_MAGIC
+	    || header.version != DCACHE_VERSION || header.key != key
+	    || header.instances != instances || !header.complete
+	    || fstat (fd, &st) != 0 || (size_t) st.st_size != size) {
+		close (fd);
+		return NULL;
+	}
+
+	map = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	cache = (dist_cache_t *) malloc_dbg (78, sizeof (dist_cache_t));
+	cache->rows = (instances - first + stride - 1) / stride;
+	cache->cols = instances - 1;
+	cache->first = first;
+	cache->stride = stride;
+	cache->pitch = (size_t) stride *cache->cols;
+	cache->entries = (dcache_entry_t *) ((char *) map +
+					     sizeof (dcache_header_t)) +
+		(size_t) first *cache->cols;
+	cache->map = map;
+	cache->map_size = size;
+	return cache;
+}
+
+/**
+ * Creates an incomplete cache file for the given key and number of
+ * instances, of its full size, for dcache_store to fill.  Returns 0, or -1
+ * with the error set (see get_last_error).
+ */
+int dcache_create_file (char *path, uint64_t key, int instances)
+{
+	dcache_header_t header;
+	int fd;
+
+	header.magic = DCACHE_MAGIC;
+	header.version = DCACHE_VERSION;
+	header.key = key;
+	header.instances = instances;
+	header.complete = 0;
+
+	fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		set_last_error ("Could not create distance cache", 0);
+		return -1;
+	}
+	if (pwrite (fd, &header, sizeof (header), 0) != sizeof (header)
+	    || ftruncate (fd, sizeof (header) + sizeof (dcache_entry_t) *
+			  (size_t) instances * (instances - 1)) != 0) {
+		close (fd);
+		set_last_error ("Could not write distance cache", 0);
+		return -1;
+	}
+	close (fd);
+	return 0;
+}
+
+/**
+ * Writes a cache's rows into their places in a file made by
+ * dcache_create_file.  Returns 0, or -1 with the error set.
+ */
+int dcache_store (dist_cache_t * cache, char *path)
+{
+	size_t len = sizeof (dcache_entry_t) * cache->cols;
+	off_t offset;
+	int fd, r;
+
+	fd = open (path, O_WRONLY);
+	if (fd < 0) {
+		set_last_error ("Could not open distance cache", 0);
+		return -1;
+	}
+	for (r = 0; r < cache->rows; r++) {
+		offset = sizeof (dcache_header_t) +
+			(off_t) len *dcache_query (cache, r);
+		if (pwrite (fd, dcache_row (cache, r), len, offset) !=
+		    (ssize_t) len) {
+			close (fd);
+			set_last_error ("Could not write distance cache", 0);
+			return -1;
+		}
+	}
+	close (fd);
+	return 0;
+}
+
+/**
+ * Marks a filled cache file complete and moves it to its final name.
+ * Returns 0, or -1 with the error set.
+ */
+int dcache_finish_file (char *tmp, char *path)
+{
+	int32_t complete = 1;
+	int fd;
+
+	fd = open (tmp, O_WRONLY);
+	if (fd < 0
+	    || pwrite (fd, &complete, sizeof (complete),
+		       offsetof (dcache_header_t, complete)) !=
+	    sizeof (complete) || fsync (fd) != 0) {
+		if (fd >= 0)
+			close (fd);
+		set_last_error ("Could not write distance cache", 0);
+		return -1;
+	}
+	close (fd);
+
+	if (rename (tmp, path) != 0) {
+		set_last_error ("Could not rename distance cache", 0);
+		return -1;
+	}
+	return 0;
+}
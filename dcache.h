@@ -0,0 +1,47 @@
+#ifndef _DCACHE_H
+#define _DCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A cache of query-to-instance distances, each query's row sorted nearest
+ * first.  The distances do not depend on the class labels, so neighbour
+ * selection under other labels (permuted, resampled) can walk a row instead
+ * of recomputing it.
+ *
+ * A cache may also be kept in a file, with a row for every instance, and
+ * mapped back in by later runs over the same data and settings; a mapped
+ * cache can be a view of every stride-th row only.
+ */
+
+typedef struct {
+	float dist;
+	int index;		/* instance index */
+} dcache_entry_t;
+
+typedef struct {
+	int rows;		/* cached queries */
+	int cols;		/* entries per row */
+	int first;		/* row r is that of instance first + r * stride */
+	int stride;
+	size_t pitch;		/* entries from one row to the next */
+	dcache_entry_t *entries;
+	void *map;		/* the mapped file, or NULL if allocated */
+	size_t map_size;
+} dist_cache_t;
+
+dist_cache_t *dcache_create (int first, int stride, int instances);
+dcache_entry_t *dcache_row (dist_cache_t * cache, int row);
+int dcache_query (dist_cache_t * cache, int row);
+void dcache_sort_row (dist_cache_t * cache, int row);
+void dcache_release (dist_cache_t * cache);
+
+uint64_t dcache_key (uint64_t checksum, int class_index, int difference,
+		     int *attributes, int count);
+dist_cache_t *dcache_map (char *path, uint64_t key, int instances,
+			  int first, int stride);
+int dcache_create_file (char *path, uint64_t key, int instances);
+int dcache_store (dist_cache_t * cache, char *path);
+int dcache_finish_file (char *tmp, char *path);
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <argp.h>
+#include "arff.h"
+#include "rng.h"
+#include "rows.h"
+
+/* gendata - writes a synthetic data set for the benchmarks: genotype-like
+ * nominal attributes and uniform numeric ones, with a planted signal.  The
+ * informative attributes, spread evenly through the others, take their
+ * value from the class with the given probability and a random one
+ * otherwise (numeric ones are shifted by the class instead); the rest are
+ * noise.  Every value is a pure function of the seed and its cell, so the
+ * same options always give the same file.
+ */
+
+const char *argp_program_version = "gendata 0.2";
+const char *argp_program_bug_address = "<chris-johnson@utulsa.edu>";
+
+static char doc[] =
+	"gendata - synthetic data with a planted signal, for benchmarking prelieff";
+
+static char args_doc[] = "ARFF_FILE";
+
+/* Streams of the draws, one per purpose */
+#define GEN_STREAM_TYPE		1	/* which attributes are numeric */
+#define GEN_STREAM_CLASS	2	/* the class of each instance */
+#define GEN_STREAM_SIGNAL	3	/* whether an informative cell follows it */
+#define GEN_STREAM_VALUE	4	/* the random values */
+
+static struct argp_option options[] = {
+	{"instances", 'n', "NUM", 0, "Number of instances (Default: 1000)"},
+	{"attributes", 'a', "NUM", 0,
+	 "Number of attributes, besides the class (Default: 100)"},
+	{"arity", 'r', "NUM", 0,
+	 "Values of each nominal attribute (Default: 3, as genotypes)"},
+	{"numeric", 'f', "FRACTION", 0,
+	 "Fraction of the attributes that are numeric (Default: 0)"},
+	{"classes", 'c', "NUM", 0, "Number of classes (Default: 2)"},
+	{"informative", 'i', "NUM", 0,
+	 "Number of attributes that carry the signal (Default: 10)"},
+	{"signal", 'p', "PROB", 0,
+	 "Strength of the signal, from 0 (none) to 1 (Default: 0.5)"},
+	{"seed", 's', "NUM", 0, "Random seed (Default: 1)"},
+	{"rows", 'b', "FILE", 0,
+	 "Also write the data as a row file (see --stream)"},
+	{0}
+};
+
+struct arguments {
+	char *arff;
+	char *rows;
+	int instances, attributes, arity, classes, informative, seed;
+	double numeric, signal;
+};
+
+static error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+	struct arguments *arguments = state->input;
+
+	switch (key) {
+	case 'n':
+		arguments->instances = atoi (arg);
+		break;
+	case 'a':
+		arguments->attributes = atoi (arg);
+		break;
+	case 'r':
+		arguments->arity = atoi (arg);
+		break;
+	case 'f':
+		arguments->numeric = atof (arg);
+		break;
+	case 'c':
+		arguments->classes = atoi (arg);
+		break;
+	case 'i':
+		arguments->informative = atoi (arg);
+		break;
+	case 'p':
+		arguments->signal = atof (arg);
+		break;
+	case 's':
+		arguments->seed = atoi (arg);
+		break;
+	case 'b':
+		arguments->rows = arg;
+		break;
+
+	case ARGP_KEY_ARG:
+		if (state->arg_num >= 1)
+			argp_usage (state);
+
+		arguments->arff = arg;
+		break;
+
+	case ARGP_KEY_END:
+		if (state->arg_num < 1)
+			argp_usage (state);
+
+		break;
+
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+int main (int argc, char **argv)
+{
+	struct arguments arguments;
+	uint64_t key;
+	uint64_t cell;
+	char *numeric;
+	int *planted;
+	int i, j, y, stride;
+	FILE *fp;
+
+	arguments.arff = NULL;
+	arguments.rows = NULL;	// ARFF only by default
+	arguments.instances = 1000;
+	arguments.attributes = 100;
+	arguments.arity = 3;
+	arguments.numeric = 0;
+	arguments.classes = 2;
+	arguments.informative = 10;
+	arguments.signal = 0.5;
+	arguments.seed = 1;
+
+	if (argp_parse (&argp, argc, argv, 0, 0, &arguments))
+		return 1;
+
+	if (arguments.instances < 1 || arguments.attributes < 1
+	    || arguments.arity < 2 || arguments.classes < 2) {
+		fprintf (stderr,
+			 "--instances and --attributes must be positive, --arity and --classes at least 2\n");
+		return 1;
+	}
+	if (arguments.informative < 0
+	    || arguments.informative > arguments.attributes) {
+		fprintf (stderr,
+			 "--informative must be between 0 and --attributes\n");
+		return 1;
+	}
+	if (arguments.numeric < 0 || arguments.numeric > 1
+	    || arguments.signal < 0 || arguments.signal > 1) {
+		fprintf (stderr, "--numeric and --signal must be in [0, 1]\n");
+		return 1;
+	}
+
+	key = rng_key (arguments.seed);
+	numeric = (char *) malloc (arguments.attributes);
+	planted = (int *) calloc (arguments.attributes, sizeof (int));
+	for (j = 0; j < arguments.attributes; j++)
+		numeric[j] = rng_uniform (key, GEN_STREAM_TYPE, j) <
+			arguments.numeric;
+	stride = (arguments.informative > 0) ?
+		arguments.attributes / arguments.informative : 0;
+	for (j = 0; j < arguments.informative; j++)
+		planted[j * stride] = 1;
+
+	fp = fopen (arguments.arff, "w");
+	if (fp == NULL) {
+		fprintf (stderr, "Could not open file for writing: %s\n",
+			 arguments.arff);
+		return 1;
+	}
+
+	/* Informative attributes are named for what they are, so a ranking
+	 * shows at a glance how many it found.
+	 */
+	fprintf (fp, "@RELATION synthetic\n");
+	for (j = 0; j < arguments.attributes; j++) {
+		fprintf (fp, "@ATTRIBUTE %s%d ",
+			 planted[j] ? "signal" : "noise", j);
+		if (numeric[j]) {
+			fprintf (fp, "REAL\n");
+			continue;
+		}
+		fprintf (fp, "{");
+		for (i = 0; i < arguments.arity; i++)
+			fprintf (fp, "%s%d", (i > 0) ? "," : "", i);
+		fprintf (fp, "}\n");
+	}
+	fprintf (fp, "@ATTRIBUTE Class {");
+	for (i = 0; i < arguments.classes; i++)
+		fprintf (fp, "%sc%d", (i > 0) ? "," : "", i);
+	fprintf (fp, "}\n@DATA\n");
+
+	for (i = 0; i < arguments.instances; i++) {
+		y = rng_below (key, GEN_STREAM_CLASS, i, arguments.classes);
+		for (j = 0; j < arguments.attributes; j++) {
+			cell = (uint64_t) i *arguments.attributes + j;
+			if (numeric[j]) {
+				fprintf (fp, "%.4f,",
+					 rng_uniform (key, GEN_STREAM_VALUE,
+						      cell) +
+					 (planted[j] ? arguments.signal * y :
+					  0));
+			} else if (planted[j]
+				   && rng_uniform (key, GEN_STREAM_SIGNAL,
+						   cell) < arguments.signal) {
+				fprintf (fp, "%d,", y % arguments.arity);
+			} else {
+				fprintf (fp, "%d,",
+					 rng_below (key, GEN_STREAM_VALUE,
+						    cell, arguments.arity));
+			}
+		}
+		fprintf (fp, "c%d\n", y);
+	}
+	free (numeric);
+	free (planted);
+
+	i = ferror (fp);
+	if (fclose (fp) != 0 || i) {
+		fprintf (stderr, "Could not write file: %s\n", arguments.arff);
+		return 1;
+	}
+
+	if (arguments.rows != NULL
+	    && rows_convert (arguments.arff, "Class", arguments.rows) != 0) {
+		fprintf (stderr, "%s: %s\n", arguments.rows, get_last_error ());
+		return 1;
+	}
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 static double *m_sortArray;
+static double *m_tieArray;
 
 int compindex (const void *p1, const void *p2)
 {
@@ -20,3 +21,24 @@ void index_sort (int *index, double *x, int size)
 	m_sortArray = x;
 	qsort (index, size, sizeof (int), compindex);
 }
+
+int compindex_ties (const void *p1, const void *p2)
+{
+	int c = compindex (p1, p2);
+	double y1 = m_tieArray[*(int *) p1];
+	double y2 = m_tieArray[*(int *) p2];
+	return c ? c : ((y1 < y2) ? -1 : ((y1 == y2) ? 0 : 1));
+}
+
+/* Like index_sort, with ties in x put in ascending order of tie. */
+void index_sort_ties (int *index, double *x, double *tie, int size)
+{
+	int i;
+	for (i = 0; i < size; i++) {
+		index[i] = i;
+	}
+
+	m_sortArray = x;
+	m_tieArray = tie;
+	qsort (index, size, sizeof (int), compindex_ties);
+}
@@ -2,5 +2,6 @@
 #define _INDEXSORT_H
 
 void index_sort (int *index, double *x, int size);
+void index_sort_ties (int *index, double *x, double *tie, int size);
 
 #endif
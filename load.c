@@ -0,0 +1,506 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "arff.h"
+#include "load.h"
+#include "util.h"
+#ifndef NO_MPI
+#include "mpi.h"
+#endif
+
+/* Dataset loading for a parallel run.
+ *
+ * By default every rank parses the ARFF file on its own.  With LOAD_SHARED,
+ * only the first rank on each node (as grouped by MPI_Comm_split_type) reads
+ * the file.  It moves the instance rows into an MPI-3 shared memory window
+ * and ships the header to its node peers, who map the same rows instead of
+ * holding a copy.  The rows are read-only once loaded.
+ *
+ * With LOAD_BCAST, only rank 0 parses.  The header is broadcast as a flat
+ * buffer and the rows follow as raw data_t cells in fixed-size chunks, a few
+ * non-blocking broadcasts in flight at a time so rank 0 can compact the next
+ * chunk while the previous one travels down the tree.  Combined with
+ * LOAD_SHARED, the rows go to one rank per node, straight into the window.
+ *
+ * With LOAD_PARTITION, each rank reads every instance but keeps only every
+ * size-th attribute, starting at its rank, plus the class.  Every attribute
+ * but the class is owned by exactly one rank; the class is owned by the rank
+ * its index falls to.  partition_header and partition_weights put the
+ * attribute names and weights back together, in file order, on rank 0.
+ *
+ * With LOAD_BLOCK, the ranks form the rows x cols grid of block_grid and
+ * rank (r, c) keeps only the instances of its row panel (index % rows == r)
+ * and its column panel (index % cols == c), all attributes included.
+ */
+
+/* Bytes per broadcast chunk, and chunks in flight. */
+#define BCAST_CHUNK	(1 << 24)
+#define BCAST_DEPTH	2
+
+/**
+  * The process grid for LOAD_BLOCK: as square as the rank count allows.
+  */
+void block_grid (int *rows, int *cols)
+{
+#ifdef NO_MPI
+	*rows = *cols = 1;
+#else
+	int size, dims[2] = { 0, 0 };
+
+	MPI_Comm_size (MPI_COMM_WORLD, &size);
+	MPI_Dims_create (size, 2, dims);
+	*rows = dims[0];
+	*cols = dims[1];
+#endif
+}
+
+#ifdef NO_MPI
+
+arff_info_t *load_arff (char *filename, char *class_attribute_name,
+			int flags)
+{
+	arff_filter_t keep = { 1, 0 };
+
+	if (flags & LOAD_PARTITION)
+		return read_arff_filtered (filename, class_attribute_name,
+					   &keep);
+
+	return read_arff (filename, class_attribute_name);
+}
+
+void unload_arff (arff_info_t * info)
+{
+	release_read_info (info);
+}
+
+#else
+
+static int block_panel[4];	/* rows, cols, r, c */
+
+static int keep_panel (int index, void *arg)
+{
+	int *panel = (int *) arg;
+
+	return (index % panel[0] == panel[2])
+		|| (index % panel[1] == panel[3]);
+}
+
+typedef struct _shared_t {
+	arff_info_t *info;
+	MPI_Win win;
+	MPI_Comm node;
+	struct _shared_t *next;
+} shared_t;
+
+static shared_t *first_shared;
+
+/**
+  * Tell every rank of comm whether rank 0 managed to read the file, passing
+  * the parse error along if not.
+  */
+static int bcast_status (arff_info_t * info, MPI_Comm comm)
+{
+	char err[200];
+	int status[2];
+	int rank;
+
+	MPI_Comm_rank (comm, &rank);
+	if (rank == 0) {
+		status[0] = (info != NULL);
+		status[1] = get_lineno ();
+		strncpy (err, get_last_error (), sizeof (err) - 1);
+		err[sizeof (err) - 1] = '\0';
+	}
+	MPI_Bcast (status, 2, MPI_INT, 0, comm);
+	if (!status[0]) {
+		MPI_Bcast (err, sizeof (err), MPI_CHAR, 0, comm);
+		set_last_error (err, status[1]);
+	}
+	return status[0];
+}
+
+/**
+  * Give every rank of comm a copy of rank 0's header.  Instances are not
+  * attached on the receiving side.
+  */
+static arff_info_t *bcast_header (arff_info_t * info, MPI_Comm comm)
+{
+	char *buf = NULL;
+	long len = 0;
+	int rank;
+
+	MPI_Comm_rank (comm, &rank);
+	if (rank == 0)
+		len = arff_pack_header (info, &buf);
+	MPI_Bcast (&len, 1, MPI_LONG, 0, comm);
+	if (rank != 0)
+		buf = (char *) malloc_dbg (38, len);
+	MPI_Bcast (buf, len, MPI_CHAR, 0, comm);
+	if (rank != 0)
+		info = arff_unpack_header (buf, len);
+	free (buf);
+
+	return info;
+}
+
+/**
+  * Broadcast the rows of rank 0's info into block on every rank of comm.
+  * Rank 0 compacts its parsed rows into its own block chunk by chunk, just
+  * ahead of sending them.
+  */
+static void bcast_rows (arff_info_t * info, data_t * block, MPI_Comm comm)
+{
+	MPI_Request req[BCAST_DEPTH];
+	size_t row = sizeof (data_t) * info->num_attributes;
+	int rows, first, count, c, rank;
+
+	MPI_Comm_rank (comm, &rank);
+
+	rows = (row > 0 && row < BCAST_CHUNK) ? BCAST_CHUNK / row : 1;
+	for (c = 0; c < BCAST_DEPTH; c++)
+		req[c] = MPI_REQUEST_NULL;
+
+	for (first = 0, c = 0; first < info->num_instances;
+	     first += rows, c = (c + 1) % BCAST_DEPTH) {
+		count = info->num_instances - first;
+		if (count > rows)
+			count = rows;
+
+		MPI_Wait (&req[c], MPI_STATUS_IGNORE);
+		if (rank == 0)
+			arff_compact_rows (info, block, first, count);
+		MPI_Ibcast (block + (size_t) first * info->num_attributes,
+			    (int) (count * row), MPI_BYTE, 0, comm, &req[c]);
+	}
+	MPI_Waitall (BCAST_DEPTH, req, MPI_STATUSES_IGNORE);
+}
+
+arff_info_t *load_arff (char *filename, char *class_attribute_name,
+			int flags)
+{
+	arff_info_t *info = NULL;
+	shared_t *shared;
+	MPI_Comm node = MPI_COMM_NULL, header, data = MPI_COMM_NULL;
+	MPI_Win win;
+	MPI_Aint size;
+	data_t *block;
+	arff_filter_t keep;
+	int rank, node_rank = 0, reader, disp, ok;
+
+	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+	keep.keep_instance = NULL;
+	keep.take_row = NULL;
+	keep.arg = NULL;
+
+	if (flags & LOAD_PARTITION) {
+		MPI_Comm_size (MPI_COMM_WORLD, &keep.attr_stride);
+		keep.attr_offset = rank;
+		return read_arff_filtered (filename, class_attribute_name,
+					   &keep);
+	}
+
+	if (flags & LOAD_BLOCK) {
+		block_grid (&block_panel[0], &block_panel[1]);
+		block_panel[2] = rank / block_panel[1];
+		block_panel[3] = rank % block_panel[1];
+		keep.attr_stride = 1;
+		keep.attr_offset = 0;
+		keep.keep_instance = keep_panel;
+		keep.arg = block_panel;
+		return read_arff_filtered (filename, class_attribute_name,
+					   &keep);
+	}
+
+	if (!(flags & (LOAD_SHARED | LOAD_BCAST)))
+		return read_arff (filename, class_attribute_name);
+	if (flags & LOAD_SHARED) {
+		MPI_Comm_split_type (MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+				     0, MPI_INFO_NULL, &node);
+		MPI_Comm_rank (node, &node_rank);
+	}
+
+	/* Who parses, who needs the header from whom, who receives rows */
+	if (flags & LOAD_BCAST) {
+		reader = (rank == 0);
+		header = MPI_COMM_WORLD;
+		if (flags & LOAD_SHARED)
+			MPI_Comm_split (MPI_COMM_WORLD,
+					node_rank == 0 ? 0 : MPI_UNDEFINED,
+					0, &data);
+		else
+			data = MPI_COMM_WORLD;
+	} else {
+		reader = (node_rank == 0);
+		header = node;
+	}
+
+	if (reader)
+		info = read_arff (filename, class_attribute_name);
+	if (!bcast_status (info, header)) {
+		if (node != MPI_COMM_NULL)
+			MPI_Comm_free (&node);
+		if (data != MPI_COMM_NULL && data != MPI_COMM_WORLD)
+			MPI_Comm_free (&data);
+		return NULL;
+	}
+	info = bcast_header (info, header);
+
+	size = (MPI_Aint) sizeof (data_t) * info->num_instances *
+		info->num_attributes;
+
+	if (flags & LOAD_SHARED) {
+		if (node_rank != 0)
+			size = 0;
+		MPI_Win_allocate_shared (size, sizeof (data_t),
+					 MPI_INFO_NULL, node, &block, &win);
+		if (node_rank != 0)
+			MPI_Win_shared_query (win, 0, &size, &disp, &block);
+		MPI_Win_lock_all (MPI_MODE_NOCHECK, win);
+	} else {
+		block = (data_t *) malloc_dbg (40, size);
+		// every rank gives up if any of them is short of memory
+		ok = (block != NULL || size == 0);
+		MPI_Allreduce (MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN,
+			       MPI_COMM_WORLD);
+		if (!ok) {
+			free (block);
+			release_read_info (info);
+			if (data != MPI_COMM_NULL && data != MPI_COMM_WORLD)
+				MPI_Comm_free (&data);
+			set_last_error ("Out of memory for the rows", 0);
+			return NULL;
+		}
+	}
+
+	if (data != MPI_COMM_NULL)
+		bcast_rows (info, block, data);
+	if (reader)
+		arff_compact (info, block);
+	else
+		arff_attach_block (info, block);
+
+	if (flags & LOAD_SHARED) {
+		MPI_Win_sync (win);
+		MPI_Barrier (node);
+		MPI_Win_sync (win);
+		MPI_Win_unlock_all (win);
+
+		shared = (shared_t *) malloc_dbg (39, sizeof (shared_t));
+		shared->info = info;
+		shared->win = win;
+		shared->node = node;
+		shared->next = first_shared;
+		first_shared = shared;
+	} else {
+		info->block_owned = 1;
+	}
+
+	if (data != MPI_COMM_NULL && data != MPI_COMM_WORLD)
+		MPI_Comm_free (&data);
+
+	return info;
+}
+
+void unload_arff (arff_info_t * info)
+{
+	shared_t **p, *shared;
+
+	for (p = &first_shared; *p != NULL; p = &(*p)->next) {
+		if ((*p)->info == info) {
+			shared = *p;
+			*p = shared->next;
+			release_read_info (info);
+			MPI_Win_free (&shared->win);
+			MPI_Comm_free (&shared->node);
+			free (shared);
+			return;
+		}
+	}
+
+	release_read_info (info);
+}
+
+#endif
+
+/**
+  * Whether this rank owns local attribute j of a partitioned load.
+  */
+static int owned (arff_info_t * info, int j, int rank, int size)
+{
+	return (j != info->class_index)
+		|| (info->attr_map[j] % size == rank);
+}
+
+/**
+  * Collect the attribute names of a partitioned load on rank 0.
+  *
+  * @param info the local slice
+  * @param num_attributes set to the number of attributes in the file
+  * @return on rank 0, a header-only info in file order (no instances, no
+  * nominal values); NULL elsewhere
+  */
+arff_info_t *partition_header (arff_info_t * info, int *num_attributes)
+{
+	arff_info_t *header = NULL;
+	attr_info_t *attr;
+	char *buf, *all = NULL;
+	int rank = 0, size = 1, len = 0, total = 0, count = 0;
+	int j, index;
+
+#ifndef NO_MPI
+	int *lens = NULL, *displs = NULL;
+	int i;
+
+	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+	MPI_Comm_size (MPI_COMM_WORLD, &size);
+#endif
+
+	/* (file index, name) for each attribute this rank owns */
+	for (j = 0; j < info->num_attributes; j++) {
+		if (owned (info, j, rank, size)) {
+			len += sizeof (int) + strlen (info->attributes[j]->name)
+				+ 1;
+			count++;
+		}
+	}
+	buf = (char *) malloc_dbg (46, len);
+	for (j = 0, len = 0; j < info->num_attributes; j++) {
+		if (owned (info, j, rank, size)) {
+			memcpy (buf + len, &info->attr_map[j], sizeof (int));
+			len += sizeof (int);
+			strcpy (buf + len, info->attributes[j]->name);
+			len += strlen (info->attributes[j]->name) + 1;
+		}
+	}
+
+#ifdef NO_MPI
+	all = buf;
+	total = len;
+	*num_attributes = count;
+#else
+	MPI_Allreduce (&count, num_attributes, 1, MPI_INT, MPI_SUM,
+		       MPI_COMM_WORLD);
+	if (rank == 0) {
+		lens = (int *) malloc_dbg (47, sizeof (int) * size);
+		displs = (int *) malloc_dbg (48, sizeof (int) * size);
+	}
+	MPI_Gather (&len, 1, MPI_INT, lens, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (rank == 0) {
+		for (i = 0; i < size; i++) {
+			displs[i] = total;
+			total += lens[i];
+		}
+		all = (char *) malloc_dbg (49, total);
+	}
+	MPI_Gatherv (buf, len, MPI_CHAR, all, lens, displs, MPI_CHAR, 0,
+		     MPI_COMM_WORLD);
+	free (buf);
+	free (lens);
+	free (displs);
+#endif
+
+	if (rank == 0) {
+		header = (arff_info_t *) malloc_dbg (26,
+						     sizeof (arff_info_t));
+		memset (header, 0, sizeof (arff_info_t));
+		header->relation_name =
+			(char *) malloc_dbg (27,
+					     strlen (info->relation_name) +
+					     1);
+		strcpy (header->relation_name, info->relation_name);
+		header->num_attributes = *num_attributes;
+		header->class_index = info->attr_map[info->class_index];
+		header->attributes =
+			(attr_info_t **) malloc_dbg (29,
+						     sizeof (attr_info_t *) *
+						     *num_attributes);
+
+		for (len = 0; len < total;) {
+			memcpy (&index, all + len, sizeof (int));
+			len += sizeof (int);
+			attr = (attr_info_t *) malloc_dbg (31,
+							   sizeof
+							   (attr_info_t));
+			attr->name = (char *) malloc_dbg (32,
+							  strlen (all + len) +
+							  1);
+			strcpy (attr->name, all + len);
+			len += strlen (all + len) + 1;
+			attr->type = ATTR_NUM_TYPES;
+			attr->nom_info = NULL;
+			attr->next = NULL;
+			header->attributes[index] = attr;
+		}
+	}
+	free (all);
+
+	return header;
+}
+
+/**
+  * Collect the weights of a partitioned run on rank 0.
+  *
+  * @param info the local slice
+  * @param weights the weights of the local attributes
+  * @param all on rank 0, room for the weights of every attribute in the file
+  */
+void partition_weights (arff_info_t * info, double *weights, double *all)
+{
+	double *w;
+	int *index;
+	int rank = 0, size = 1, count = 0;
+	int i, j;
+
+#ifndef NO_MPI
+	int total = 0;
+	int *counts = NULL, *displs = NULL, *all_index = NULL;
+	double *all_w = NULL;
+
+	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+	MPI_Comm_size (MPI_COMM_WORLD, &size);
+#endif
+
+	w = (double *) malloc_dbg (50, sizeof (double) * info->num_attributes);
+	index = (int *) malloc_dbg (51, sizeof (int) * info->num_attributes);
+	for (j = 0; j < info->num_attributes; j++) {
+		if (owned (info, j, rank, size)) {
+			w[count] = weights[j];
+			index[count] = info->attr_map[j];
+			count++;
+		}
+	}
+
+#ifdef NO_MPI
+	for (i = 0; i < count; i++)
+		all[index[i]] = w[i];
+#else
+	if (rank == 0) {
+		counts = (int *) malloc_dbg (47, sizeof (int) * size);
+		displs = (int *) malloc_dbg (48, sizeof (int) * size);
+	}
+	MPI_Gather (&count, 1, MPI_INT, counts, 1, MPI_INT, 0,
+		    MPI_COMM_WORLD);
+	if (rank == 0) {
+		for (i = 0; i < size; i++) {
+			displs[i] = total;
+			total += counts[i];
+		}
+		all_w = (double *) malloc_dbg (52, sizeof (double) * total);
+		all_index = (int *) malloc_dbg (53, sizeof (int) * total);
+	}
+	MPI_Gatherv (w, count, MPI_DOUBLE, all_w, counts, displs,
+		     MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	MPI_Gatherv (index, count, MPI_INT, all_index, counts, displs,
+		     MPI_INT, 0, MPI_COMM_WORLD);
+	for (i = 0; i < total; i++)
+		all[all_index[i]] = all_w[i];
+
+	free (counts);
+	free (displs);
+	free (all_w);
+	free (all_index);
+#endif
+
+	free (w);
+	free (index);
+}
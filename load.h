@@ -0,0 +1,20 @@
+#ifndef _LOAD_H
+#define _LOAD_H
+
+#include "arff.h"
+
+/* load_arff flags */
+#define LOAD_SHARED	1	/* one reader per node, rows in shared memory */
+#define LOAD_BCAST	2	/* rank 0 parses and broadcasts the rows */
+#define LOAD_PARTITION	4	/* each rank keeps a slice of the attributes */
+#define LOAD_BLOCK	8	/* each rank keeps a row and a column panel */
+
+arff_info_t *load_arff (char *filename, char *class_attribute_name,
+			int flags);
+void unload_arff (arff_info_t * info);
+void block_grid (int *rows, int *cols);
+
+arff_info_t *partition_header (arff_info_t * info, int *num_attributes);
+void partition_weights (arff_info_t * info, double *weights, double *all);
+
+#endif
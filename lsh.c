@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lsh.h"
+#include "util.h"
+
+/**
+ * Allocates an index of the given number of tables over instances, with
+ * keys of the given number of parts, at most 64; the caller sets every
+ * part (see lsh_add_part) before lsh_build.
+ */
+lsh_index_t *lsh_create (int tables, int parts, int instances)
+{
+	lsh_index_t *index;
+
+	index = (lsh_index_t *) malloc_dbg (132, sizeof (lsh_index_t));
+	index->tables = tables;
+	index->parts = parts;
+	index->width = 64 / parts;
+	index->instances = instances;
+	index->keys = (uint64_t *) malloc_dbg (133, sizeof (uint64_t) *
+					       (size_t) tables * instances);
+	index->entries = (lsh_entry_t *) malloc_dbg (134,
+						     sizeof (lsh_entry_t) *
+						     (size_t) tables *
+						     instances);
+	memset (index->keys, 0, sizeof (uint64_t) * (size_t) tables *
+		instances);
+	return index;
+}
+
+/**
+ * Sets a part of an instance's key in a table.  Values are hashed down to
+ * the part's width, so different values may share a part, and only make
+ * a bucket wider.
+ */
+void lsh_add_part (lsh_index_t * index, int table, int part, int instance,
+		   uint64_t value)
+{
+	uint64_t bits;
+
+	bits = ((value + 1) * 0x9e3779b97f4a7c15ULL) >> (64 - index->width);
+	index->keys[(size_t) table * index->instances + instance] |=
+		bits << (64 - index->width * (part + 1));
+}
+
+static int compentry (const void *p1, const void *p2)
+{
+	const lsh_entry_t *a = (const lsh_entry_t *) p1;
+	const lsh_entry_t *b = (const lsh_entry_t *) p2;
+
+	if (a->key != b->key)
+		return (a->key < b->key) ? -1 : 1;
+	return (a->index < b->index) ? -1 : (a->index > b->index);
+}
+
+/* Sorts each table's instances by key, so a bucket is a run of entries */
+void lsh_build (lsh_index_t * index)
+{
+	lsh_entry_t *table;
+	int t, i;
+
+	for (t = 0; t < index->tables; t++) {
+		table = index->entries + (size_t) t *index->instances;
+		for (i = 0; i < index->instances; i++) {
+			table[i].key =
+				index->keys[(size_t) t * index->instances + i];
+			table[i].index = i;
+		}
+		qsort (table, index->instances, sizeof (lsh_entry_t),
+		       compentry);
+	}
+}
+
+/**
+ * The bucket of an instance in a table, agreeing with its key on the first
+ * parts parts, the whole table for 0: count entries, the instance itself
+ * among them.
+ */
+lsh_entry_t *lsh_bucket (lsh_index_t * index, int table, int instance,
+			 int parts, int *count)
+{
+	lsh_entry_t *entries = index->entries + (size_t) table *
+		index->instances;
+	uint64_t key = index->keys[(size_t) table * index->instances +
+				   instance];
+	uint64_t mask = (parts == 0) ? 0 : ~0ULL << (64 - index->width *
+						      parts);
+	int lo = 0, hi = index->instances, mid, end;
+
+	// the first entry with the prefix
+	key &= mask;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((entries[mid].key & mask) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (end = lo; end < index->instances
+	     && (entries[end].key & mask) == key; end++);
+
+	*count = end - lo;
+	return entries + lo;
+}
+
+void lsh_release (lsh_index_t * index)
+{
+	if (index == NULL)
+		return;
+
+	free (index->keys);
+	free (index->entries);
+	free (index);
+}
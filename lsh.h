@@ -0,0 +1,35 @@
+#ifndef _LSH_H
+#define _LSH_H
+
+#include <stdint.h>
+
+/* Locality-sensitive hash tables over instances, as a forest: each table
+ * files every instance under a key of parts, the first part in the top
+ * bits, so instances agreeing on the first p parts of a query's key are a
+ * contiguous bucket, wider for smaller p.  The parts come from the caller,
+ * so the same tables serve whatever hash family suits the distance.
+ */
+
+typedef struct {
+	uint64_t key;
+	int index;		/* instance index */
+} lsh_entry_t;
+
+typedef struct {
+	int tables;
+	int parts;		/* parts per key */
+	int width;		/* bits per part */
+	int instances;
+	uint64_t *keys;		/* instance i's key in table t at t * instances + i */
+	lsh_entry_t *entries;	/* per table, by key, equal keys by index */
+} lsh_index_t;
+
+lsh_index_t *lsh_create (int tables, int parts, int instances);
+void lsh_add_part (lsh_index_t * index, int table, int part, int instance,
+		   uint64_t value);
+void lsh_build (lsh_index_t * index);
+lsh_entry_t *lsh_bucket (lsh_index_t * index, int table, int instance,
+			 int parts, int *count);
+void lsh_release (lsh_index_t * index);
+
+#endif
@@ -3,11 +3,18 @@
 #include <string.h>
 #include <argp.h>
 #include <math.h>
+#include <unistd.h>
 #include "arff.h"
 #include "prelieff.h"
 #include "java.h"
 #include "index_sort.h"
 #include "util.h"
+#include "load.h"
+#include "state.h"
+#include "rows.h"
+#include "metrics.h"
+#include "perfctr.h"
+#include "trace.h"
 #ifndef NO_MPI
 #include "mpi.h"
 #endif
@@ -33,6 +40,74 @@ static struct argp_option options[] = {
 	{"arff", 'r', "FILE", 0, "Output ARFF File (Default: none)"},
 	{"prune", 'p', "NUM", 0,
 	 "Number (or percent) of attributes to prune (Default: 0)"},
+	{"shared", 'S', 0, 0,
+	 "Read the data once per node into MPI shared memory"},
+	{"bcast", 'B', 0, 0,
+	 "Parse the data on rank 0 only and broadcast it"},
+	{"partition", 'P', 0, 0,
+	 "Split the attributes across ranks, for data too wide for one node"},
+	{"batch", 'b', "NUM", 0,
+	 "Queries per distance reduction with --partition, or per check with --converge (Default: 64)"},
+	{"block", 'D', 0, 0,
+	 "Split the distance matrix into 2D blocks across ranks"},
+	{"sample", 'm', "NUM", 0,
+	 "Number of instances to sample (Default: all of them)"},
+	{"seed", 's', "NUM", 0, "Random seed for sampling (Default: 1)"},
+	{"without-replacement", 'w', 0, 0,
+	 "Sample each instance at most once"},
+	{"converge", 'k', "NUM", 0,
+	 "Sample in random order and stop once the top NUM attributes settle"},
+	{"patience", 'n', "NUM", 0,
+	 "Unchanged checks before --converge stops (Default: 3)"},
+	{"state", 'i', "FILE", 0,
+	 "Update incrementally from the saved state in FILE, if any, and save the new state there"},
+	{"verify", 'v', 0, 0,
+	 "Check an incremental --state update against a full run"},
+	{"sweep-k", 'K', "LIST", 0,
+	 "Rank for each number of neighbours in LIST (e.g. 5,10,20) from one neighbour search, one ranking file each"},
+	{"sweep-sigma", 'G', "LIST", 0,
+	 "Sigmas for --sweep-k; 0 weights the neighbours equally (Default: 2)"},
+	{"permutations", 'T', "NUM", 0,
+	 "Add a p-value column from NUM label permutations, reusing the distances"},
+	{"bootstrap", 'R', "NUM", 0,
+	 "Rank NUM bootstrap replicates from one distance computation, with a stability summary"},
+	{"folds", 'F', "NUM", 0,
+	 "Rank the training sets of NUM cross-validation folds, likewise"},
+	{"top", 'o', "NUM", 0,
+	 "Top size for the --bootstrap and --folds stability summary and --compare (Default: 10)"},
+	{"cache", 'C', "DIR", 0,
+	 "Keep the sorted distances in DIR (shared by the ranks), keyed by data and settings, and map them on later runs instead of recomputing"},
+	{"stream", 'O', "FILE", 0,
+	 "Work out of core from the row file FILE, made from ARFF_FILE first if it does not exist"},
+	{"memory", 'M', "MB", 0,
+	 "Memory limit for --stream, per rank (Default: 1024)"},
+	{"dedup", 'u', 0, 0,
+	 "Collapse identical instances of a class into one, counted as many times"},
+	{"collapse", 'l', 0, 0,
+	 "Score identical attribute columns as one, each getting its weight"},
+	{"lsh", 'L', "TABLES", 0,
+	 "Approximate the neighbours from TABLES locality-sensitive hash tables"},
+	{"lsh-bits", 'H', "NUM", 0,
+	 "Sampled attributes per --lsh key; more is faster, fewer finds more (Default: 8)"},
+	{"compare", 'Q', 0, 0,
+	 "Also run exact Relief-F and report how well the --lsh or --quantize ranking agrees"},
+	{"lsh-compare", 0, 0, OPTION_ALIAS},
+	{"vptree", 'V', 0, 0,
+	 "Find the exact neighbours with a vantage-point tree per class, reporting node and distance counts"},
+	{"sparse", 'E', "DENSITY", 0,
+	 "Keep all-nominal data as deviations from each column's most common value when fewer than DENSITY of the values deviate; 0 never (Default: 0.05)"},
+	{"quantize", 'q', 0, 0,
+	 "Search for neighbours with each numeric attribute binned to a byte (approximate)"},
+	{"rescore", 'x', 0, 0,
+	 "With --quantize, order the neighbours found and update the weights at full precision"},
+	{"metrics", 'J', "FILE", 0,
+	 "Write a JSON summary of the run to FILE: wall-clock time per phase across the ranks, distances, early abandonment and bytes scanned"},
+	{"counters", 'U', 0, 0,
+	 "With --metrics, count cycles, instructions, cache and branch misses in each phase (Linux)"},
+	{"trace", 'Y', "FILE", 0,
+	 "Write a timeline of every rank's and thread's phases and queries to FILE, in the Chrome trace format"},
+	{"turf", 't', "PCT", 0,
+	 "Iterate, dropping PCT% of the remaining attributes each round until the --prune count is gone (TuRF)"},
 	{0}
 };
 
@@ -42,6 +117,28 @@ struct arguments {
 	char *class;
 	char *prune;
 	char *arff_out;
+	int load_flags;
+	int batch;
+	int sample, seed, replace;
+	double turf;
+	int converge, patience;
+	char *state;
+	int verify;
+	char *sweep_k, *sweep_sigma;
+	int permutations;
+	int bootstrap, folds, top;
+	char *cache;
+	char *stream;
+	int memory;
+	int dedup;
+	int collapse;
+	int lsh, lsh_bits, compare;
+	int vptree;
+	double sparse;
+	int quantize, rescore;
+	char *metrics;
+	int counters;
+	char *trace;
 };
 
 static error_t parse_opt (int key, char *arg, struct argp_state *state)
@@ -65,6 +162,108 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 		/* Maintain string form until we know how many attributes there are, in case this is a percentage. */
 		arguments->prune = arg;
 		break;
+	case 'S':
+		arguments->load_flags |= LOAD_SHARED;
+		break;
+	case 'B':
+		arguments->load_flags |= LOAD_BCAST;
+		break;
+	case 'P':
+		arguments->load_flags |= LOAD_PARTITION;
+		break;
+	case 'b':
+		arguments->batch = atoi (arg);
+		break;
+	case 'D':
+		arguments->load_flags |= LOAD_BLOCK;
+		break;
+	case 'm':
+		arguments->sample = atoi (arg);
+		break;
+	case 's':
+		arguments->seed = atoi (arg);
+		break;
+	case 'w':
+		arguments->replace = false;
+		break;
+	case 't':
+		arguments->turf = atof (arg);
+		break;
+	case 'k':
+		arguments->converge = atoi (arg);
+		break;
+	case 'n':
+		arguments->patience = atoi (arg);
+		break;
+	case 'i':
+		arguments->state = arg;
+		break;
+	case 'v':
+		arguments->verify = true;
+		break;
+	case 'K':
+		arguments->sweep_k = arg;
+		break;
+	case 'G':
+		arguments->sweep_sigma = arg;
+		break;
+	case 'T':
+		arguments->permutations = atoi (arg);
+		break;
+	case 'R':
+		arguments->bootstrap = atoi (arg);
+		break;
+	case 'F':
+		arguments->folds = atoi (arg);
+		break;
+	case 'o':
+		arguments->top = atoi (arg);
+		break;
+	case 'C':
+		arguments->cache = arg;
+		break;
+	case 'O':
+		arguments->stream = arg;
+		break;
+	case 'u':
+		arguments->dedup = true;
+		break;
+	case 'l':
+		arguments->collapse = true;
+		break;
+	case 'L':
+		arguments->lsh = atoi (arg);
+		break;
+	case 'H':
+		arguments->lsh_bits = atoi (arg);
+		break;
+	case 'Q':
+		arguments->compare = true;
+		break;
+	case 'V':
+		arguments->vptree = true;
+		break;
+	case 'E':
+		arguments->sparse = atof (arg);
+		break;
+	case 'q':
+		arguments->quantize = true;
+		break;
+	case 'x':
+		arguments->rescore = true;
+		break;
+	case 'J':
+		arguments->metrics = arg;
+		break;
+	case 'U':
+		arguments->counters = true;
+		break;
+	case 'Y':
+		arguments->trace = arg;
+		break;
+	case 'M':
+		arguments->memory = atoi (arg);
+		break;
 
 	case ARGP_KEY_ARG:
 		if (state->arg_num >= 2)
@@ -88,16 +287,292 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
+/* Ranks the attributes by weight, best first, but removes the class
+ * attribute.
+ */
+static int *rank_attributes (double *ranked, int num_attributes,
+			     int class_index)
+{
+	int *indices;
+	int *tmp = calloc (num_attributes, sizeof (int));
+
+	index_sort (tmp, ranked, num_attributes);
+	indices = remove_int (tmp, num_attributes, class_index);
+
+	/* In case we've gone crazy, fall back to original behavior */
+	if (indices == NULL)
+		indices = tmp;
+	else
+		free (tmp);
+
+	return indices;
+}
+
+/* We generate a two-columned CSV, or three with the p-values */
+static void write_ranking (FILE * outfile, arff_info_t * header,
+			   double *ranked, double *pvalues, int *indices,
+			   int retained)
+{
+	int i;
+
+	for (i = 0; i < retained; i++) {
+		fprintf (outfile, "%s,%.3f",
+			 header->attributes[indices[i]]->name,
+			 ranked[indices[i]]);
+		if (pvalues != NULL)
+			fprintf (outfile, ",%.4f", pvalues[indices[i]]);
+		fprintf (outfile, "\n");
+	}
+}
+
+/* Parses a comma-separated list of numbers of at least min.  Returns how
+ * many, or -1 if one is not such a number.
+ */
+static int parse_list (char *arg, int min, int **values)
+{
+	int n = 1;
+	char *p, *end;
+
+	for (p = arg; *p; p++)
+		if (*p == ',')
+			n++;
+	*values = calloc (n, sizeof (int));
+
+	for (n = 0, p = arg;; p = end + 1) {
+		(*values)[n] = (int) strtol (p, &end, 10);
+		if (end == p || (*values)[n++] < min
+		    || (*end != ',' && *end != '\0'))
+			return -1;
+		if (*end == '\0')
+			return n;
+	}
+}
+
+/* The name of an extra output file: the rank file name with tag put in
+ * before its extension.
+ */
+static char *output_name (char *rankfile, char *tag)
+{
+	char *name = malloc (strlen (rankfile) + strlen (tag) + 2);
+	char *dot = strrchr (rankfile, '.');
+	char *slash = strrchr (rankfile, '/');
+
+	if (dot == NULL || (slash != NULL && dot < slash))
+		dot = rankfile + strlen (rankfile);
+
+	sprintf (name, "%.*s.%s%s", (int) (dot - rankfile), rankfile, tag,
+		 dot);
+	return name;
+}
+
+/* The ranking file of one --sweep setting */
+static char *sweep_name (char *rankfile, relief_config_t * config)
+{
+	char tag[64];
+
+	if (config->weight_by_distance)
+		sprintf (tag, "k%d.s%d", config->knn, config->sigma);
+	else
+		sprintf (tag, "k%d.equal", config->knn);
+	return output_name (rankfile, tag);
+}
+
+/* Writes the ranking file of each resampled replicate (named tag1, tag2,
+ * ...) and the rank stability summary: for each attribute, its mean weight,
+ * the mean and standard deviation of its rank and the share of replicates
+ * with it in the top, best mean rank first; and on stdout, the mean
+ * Spearman correlation and top overlap over all pairs of replicates.
+ * Returns 0, or 1 if a file could not be written.
+ */
+static int write_resampled (char *rankfile, char *tag, FILE * outfile,
+			    arff_info_t * header, double **weights, int count,
+			    int num_attributes, int retained, int top)
+{
+	int n = num_attributes - 1;
+	int **order = calloc (count, sizeof (int *));
+	int **ranks = calloc (count, sizeof (int *));
+	double *mean_weight = calloc (num_attributes, sizeof (double));
+	double *mean_rank = calloc (num_attributes, sizeof (double));
+	double *sd_rank = calloc (num_attributes, sizeof (double));
+	double *in_top = calloc (num_attributes, sizeof (double));
+	double rho = 0, overlap = 0;
+	int *summary;
+	int i, r, s, pairs = 0;
+	char name[64];
+
+	if (top > n)
+		top = n;
+
+	for (r = 0; r < count; r++) {
+		char *file;
+		FILE *fp;
+
+		sprintf (name, "%s%d", tag, r + 1);
+		file = output_name (rankfile, name);
+		fp = fopen (file, "w");
+		if (fp == NULL) {
+			fprintf (stderr, "Could not open file for writing: %s\n",
+				 file);
+			return 1;
+		}
+
+		order[r] = rank_attributes (weights[r], num_attributes,
+					    header->class_index);
+		write_ranking (fp, header, weights[r], NULL, order[r],
+			       retained);
+		fclose (fp);
+		free (file);
+
+		/* Rank of each attribute, the class left out */
+		ranks[r] = calloc (n, sizeof (int));
+		for (i = 0; i < n; i++) {
+			int a = order[r][i];
+
+			ranks[r][a - (a > header->class_index)] = i + 1;
+			mean_weight[a] += weights[r][a] / count;
+			mean_rank[a] += (i + 1.0) / count;
+			in_top[a] += (i < top) ? 1.0 / count : 0;
+		}
+	}
+
+	for (r = 0; r < count; r++) {
+		for (i = 0; i < n; i++) {
+			int a = order[r][i];
+			double d = i + 1 - mean_rank[a];
+
+			sd_rank[a] += d * d / count;
+		}
+		for (s = r + 1; s < count; s++, pairs++) {
+			rho += spearman (ranks[r], ranks[s], n);
+			overlap += (double) topk_overlap (order[r], order[s],
+							  top) / top;
+		}
+	}
+
+	/* Best (lowest) mean rank first */
+	for (i = 0; i < num_attributes; i++)
+		mean_rank[i] = -mean_rank[i];
+	summary = rank_attributes (mean_rank, num_attributes,
+				   header->class_index);
+	for (i = 0; i < retained; i++) {
+		int a = summary[i];
+
+		fprintf (outfile, "%s,%.3f,%.2f,%.2f,%.3f\n",
+			 header->attributes[a]->name, mean_weight[a],
+			 -mean_rank[a], sqrt (sd_rank[a]), in_top[a]);
+	}
+
+	if (pairs > 0)
+		printf ("Stability over %d replicates: mean Spearman %.4f, mean top-%d overlap %.4f\n",
+			count, rho / pairs, top, overlap / pairs);
+
+	for (r = 0; r < count; r++) {
+		free (order[r]);
+		free (ranks[r]);
+	}
+	free (order);
+	free (ranks);
+	free (summary);
+	free (mean_weight);
+	free (mean_rank);
+	free (sd_rank);
+	free (in_top);
+	return 0;
+}
+
+/* Runs exact Relief-F after an approximate run and reports, on rank 0, the
+ * times of both, the Spearman correlation of their rankings and the overlap
+ * of their top.  Returns 0, or 1 if the exact run could not be compared.
+ */
+static int compare_exact (arff_info_t * info, double *weights, int top)
+{
+	int n = info->num_attributes - 1;
+	double *exact = calloc (info->num_attributes, sizeof (double));
+	double approx_time = getTotalTime (), rho;
+	int *order[2], *ranks[2];
+	int i, r, me = 0;
+
+#ifndef NO_MPI
+	MPI_Comm_rank (MPI_COMM_WORLD, &me);
+#endif
+	if (exact == NULL)
+		return 1;
+
+	setApproximate (0, 0);
+	setQuantize (false, false);
+	buildEvaluator (info, exact);
+
+	if (me == 0) {
+		if (top > n)
+			top = n;
+		order[0] = rank_attributes (weights, info->num_attributes,
+					    info->class_index);
+		order[1] = rank_attributes (exact, info->num_attributes,
+					    info->class_index);
+		for (r = 0; r < 2; r++) {
+			ranks[r] = calloc (n, sizeof (int));
+			for (i = 0; i < n; i++) {
+				int a = order[r][i];
+
+				ranks[r][a - (a > info->class_index)] = i + 1;
+			}
+		}
+		rho = spearman (ranks[0], ranks[1], n);
+
+		printf ("Approximate %.2fs, exact %.2fs: Spearman %.4f, top-%d overlap %.4f\n",
+			approx_time, getTotalTime (), rho, top,
+			(double) topk_overlap (order[0], order[1], top) / top);
+
+		for (r = 0; r < 2; r++) {
+			free (order[r]);
+			free (ranks[r]);
+		}
+	}
+	free (exact);
+	return 0;
+}
+
+/* Narrows the active attributes to the keep best by weight, in attribute
+ * order.
+ */
+static void keep_best (int *active, int count, double *weights, int keep)
+{
+	int i;
+	int *order = calloc (count, sizeof (int));
+	double *w = calloc (count, sizeof (double));
+	char *kept = calloc (count, 1);
+
+	for (i = 0; i < count; i++)
+		w[i] = weights[active[i]];
+	index_sort (order, w, count);
+	for (i = 0; i < keep; i++)
+		kept[order[i]] = 1;
+
+	for (i = keep = 0; i < count; i++)
+		if (kept[i])
+			active[keep++] = active[i];
+
+	free (order);
+	free (w);
+	free (kept);
+}
+
 int main (int argc, char **argv)
 {
-	arff_info_t *info;
+	arff_info_t *info, *header;
 	int me;
-	double *weights;
+	double *weights, *ranked;
 	int *indices;
-	int i;
+	int i, num_attributes;
 	FILE *outfile;
-	FILE *arfffile;
+	FILE *arfffile = NULL;
 	int prune = 0;
+	relief_config_t *configs = NULL;
+	int num_configs = 0;
+	int written = false;	/* rankings already written by the mode */
+	double *pvalues = NULL;
+	row_file_t *rows = NULL;	/* the rows, if out of core */
+	int quantized = 0;	/* numeric attributes quantized, if any */
 
 	/* Argument parsing */
 	struct arguments arguments;
@@ -107,9 +582,239 @@ int main (int argc, char **argv)
 	arguments.class = "Class";	// Default class name
 	arguments.prune = "0";	// Prune 0 attributes by default
 	arguments.arff_out = NULL;	// Do not write a new ARFF file by default
+	arguments.load_flags = 0;	// Every rank reads its own copy by default
+	arguments.batch = 64;
+	arguments.sample = -1;	// Process every instance by default
+	arguments.seed = 1;
+	arguments.replace = true;
+	arguments.turf = 0;	// One round of Relief-F by default
+	arguments.converge = 0;	// Process the whole sample by default
+	arguments.patience = 3;
+	arguments.state = NULL;	// Keep no state between runs by default
+	arguments.verify = false;
+	arguments.sweep_k = NULL;	// One setting of k and sigma by default
+	arguments.sweep_sigma = "2";
+	arguments.permutations = 0;	// No significance test by default
+	arguments.bootstrap = 0;	// No resampling by default
+	arguments.folds = 0;
+	arguments.top = 10;
+	arguments.cache = NULL;	// Compute the distances every run by default
+	arguments.stream = NULL;	// Hold the data in memory by default
+	arguments.memory = 1024;
+	arguments.dedup = false;
+	arguments.collapse = false;
+	arguments.lsh = 0;	// Exact neighbours by default
+	arguments.lsh_bits = 8;
+	arguments.compare = false;
+	arguments.vptree = false;
+	arguments.sparse = 0.05;
+	arguments.quantize = false;	// Full-precision distances by default
+	arguments.rescore = false;
+	arguments.metrics = NULL;	// No run summary by default
+	arguments.counters = false;
+	arguments.trace = NULL;
 
 	if (argp_parse (&argp, argc, argv, 0, 0, &arguments))
 		return 1;
+
+	if (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)) {
+		if (arguments.algorithm == 1 || arguments.arff_out != NULL) {
+			fprintf (stderr,
+				 "--partition and --block support neither --algorithm=1 nor --arff\n");
+			return 1;
+		}
+	}
+	if (arguments.batch < 1 || arguments.patience < 1
+	    || arguments.converge < 0) {
+		fprintf (stderr,
+			 "--batch and --patience must be positive, --converge not negative\n");
+		return 1;
+	}
+	if (arguments.converge > 0 && (arguments.algorithm == 1 ||
+				       (arguments.load_flags &
+					(LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--converge supports neither --algorithm=1, --partition nor --block\n");
+		return 1;
+	}
+	if (arguments.state != NULL
+	    && (arguments.algorithm == 1 || arguments.sample >= 0
+		|| arguments.converge > 0 || arguments.turf > 0
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--state needs every instance, and supports none of --algorithm=1, --sample, --converge, --turf, --partition or --block\n");
+		return 1;
+	}
+	if (arguments.verify && arguments.state == NULL) {
+		fprintf (stderr, "--verify needs --state\n");
+		return 1;
+	}
+	if (arguments.turf < 0 || arguments.turf >= 100) {
+		fprintf (stderr, "--turf must be a percentage below 100\n");
+		return 1;
+	}
+	if (arguments.turf > 0 && (arguments.algorithm == 1 ||
+				   (arguments.load_flags & LOAD_PARTITION))) {
+		fprintf (stderr,
+			 "--turf supports neither --algorithm=1 nor --partition\n");
+		return 1;
+	}
+	if (arguments.permutations < 0
+	    || (arguments.permutations > 0
+		&& (arguments.algorithm == 1 || arguments.sample >= 0
+		    || arguments.converge > 0 || arguments.turf > 0
+		    || arguments.state != NULL || arguments.sweep_k != NULL
+		    || (arguments.load_flags &
+			(LOAD_PARTITION | LOAD_BLOCK))))) {
+		fprintf (stderr,
+			 "--permutations needs every instance, and supports none of --algorithm=1, --sample, --converge, --turf, --state, --sweep-k, --partition or --block\n");
+		return 1;
+	}
+	if (arguments.bootstrap > 0 || arguments.folds > 0) {
+		if ((arguments.bootstrap > 0 && arguments.folds > 0)
+		    || arguments.folds == 1 || arguments.top < 1) {
+			fprintf (stderr,
+				 "Use one of --bootstrap and --folds, with at least 2 folds and --top positive\n");
+			return 1;
+		}
+		if (arguments.algorithm == 1 || arguments.sample >= 0
+		    || arguments.converge > 0 || arguments.turf > 0
+		    || arguments.state != NULL || arguments.sweep_k != NULL
+		    || arguments.permutations > 0 || arguments.arff_out != NULL
+		    || (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK))) {
+			fprintf (stderr,
+				 "--bootstrap and --folds support none of --algorithm=1, --sample, --converge, --turf, --state, --sweep-k, --permutations, --arff, --partition or --block\n");
+			return 1;
+		}
+	}
+	if (arguments.cache != NULL
+	    && (arguments.algorithm == 1 || arguments.state != NULL
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--cache supports none of --algorithm=1, --state, --partition or --block\n");
+		return 1;
+	}
+	if (arguments.stream != NULL
+	    && (arguments.memory < 1 || arguments.algorithm == 1
+		|| arguments.arff_out != NULL || arguments.converge > 0
+		|| arguments.turf > 0 || arguments.state != NULL
+		|| arguments.sweep_k != NULL || arguments.permutations > 0
+		|| arguments.bootstrap > 0 || arguments.folds > 0
+		|| arguments.cache != NULL || arguments.load_flags != 0)) {
+		fprintf (stderr,
+			 "--stream needs a positive --memory, and supports no other mode and neither --algorithm=1 nor --arff\n");
+		return 1;
+	}
+	if (arguments.dedup
+	    && (arguments.algorithm == 1 || arguments.converge > 0
+		|| arguments.state != NULL || arguments.sweep_k != NULL
+		|| arguments.permutations > 0 || arguments.bootstrap > 0
+		|| arguments.folds > 0 || arguments.cache != NULL
+		|| arguments.stream != NULL
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--dedup supports no other mode and neither --algorithm=1, --converge nor --cache\n");
+		return 1;
+	}
+	if (arguments.collapse
+	    && (arguments.algorithm == 1 || arguments.converge > 0
+		|| arguments.state != NULL || arguments.sweep_k != NULL
+		|| arguments.permutations > 0 || arguments.bootstrap > 0
+		|| arguments.folds > 0 || arguments.cache != NULL
+		|| arguments.stream != NULL
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--collapse supports no other mode and neither --algorithm=1, --converge nor --cache\n");
+		return 1;
+	}
+	if (arguments.lsh < 0 || arguments.lsh_bits < 1
+	    || arguments.lsh_bits > 64
+	    || (arguments.lsh > 0
+		&& (arguments.algorithm == 1 || arguments.converge > 0
+		    || arguments.state != NULL || arguments.sweep_k != NULL
+		    || arguments.permutations > 0 || arguments.bootstrap > 0
+		    || arguments.folds > 0 || arguments.cache != NULL
+		    || arguments.stream != NULL || arguments.dedup
+		    || (arguments.load_flags &
+			(LOAD_PARTITION | LOAD_BLOCK))))) {
+		fprintf (stderr,
+			 "--lsh must not be negative, --lsh-bits must be from 1 to 64, and --lsh supports no other mode and none of --algorithm=1, --converge, --cache or --dedup\n");
+		return 1;
+	}
+	if (arguments.quantize
+	    && (arguments.algorithm == 1 || arguments.state != NULL
+		|| arguments.sweep_k != NULL || arguments.permutations > 0
+		|| arguments.bootstrap > 0 || arguments.folds > 0
+		|| arguments.cache != NULL || arguments.stream != NULL
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--quantize supports no other mode and neither --algorithm=1 nor --cache\n");
+		return 1;
+	}
+	if (arguments.rescore && !arguments.quantize) {
+		fprintf (stderr, "--rescore needs --quantize\n");
+		return 1;
+	}
+	if (arguments.counters && arguments.metrics == NULL) {
+		fprintf (stderr, "--counters needs --metrics\n");
+		return 1;
+	}
+	if (arguments.compare
+	    && ((arguments.lsh == 0 && !arguments.quantize)
+		|| arguments.turf > 0 || arguments.top < 1)) {
+		fprintf (stderr,
+			 "--compare needs --lsh or --quantize and --top positive, and does not support --turf\n");
+		return 1;
+	}
+	if (arguments.vptree
+	    && (arguments.algorithm == 1 || arguments.state != NULL
+		|| arguments.sweep_k != NULL || arguments.permutations > 0
+		|| arguments.bootstrap > 0 || arguments.folds > 0
+		|| arguments.cache != NULL || arguments.stream != NULL
+		|| arguments.dedup || arguments.lsh > 0
+		|| (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK)))) {
+		fprintf (stderr,
+			 "--vptree supports no other mode and none of --algorithm=1, --cache, --dedup or --lsh\n");
+		return 1;
+	}
+	if (arguments.sparse < 0 || arguments.sparse > 1) {
+		fprintf (stderr, "--sparse must be a density from 0 to 1\n");
+		return 1;
+	}
+	if (arguments.sweep_k != NULL) {
+		int *ks, *sigmas, nk, ns, j;
+
+		if (arguments.algorithm == 1 || arguments.state != NULL
+		    || arguments.converge > 0 || arguments.turf > 0
+		    || arguments.arff_out != NULL
+		    || (arguments.load_flags & (LOAD_PARTITION | LOAD_BLOCK))) {
+			fprintf (stderr,
+				 "--sweep-k supports none of --algorithm=1, --state, --converge, --turf, --arff, --partition or --block\n");
+			return 1;
+		}
+
+		nk = parse_list (arguments.sweep_k, 1, &ks);
+		ns = parse_list (arguments.sweep_sigma, 0, &sigmas);
+		if (nk < 0 || ns < 0) {
+			fprintf (stderr,
+				 "--sweep-k needs positive numbers, --sweep-sigma numbers not negative\n");
+			return 1;
+		}
+
+		/* Every k with every sigma */
+		num_configs = nk * ns;
+		configs = calloc (num_configs, sizeof (relief_config_t));
+		for (i = 0; i < nk; i++) {
+			for (j = 0; j < ns; j++) {
+				configs[i * ns + j].knn = ks[i];
+				configs[i * ns + j].sigma = sigmas[j];
+				configs[i * ns + j].weight_by_distance =
+					(sigmas[j] > 0);
+			}
+		}
+		free (ks);
+		free (sigmas);
+	}
 	/* End argument parsing */
 
 
@@ -119,6 +824,14 @@ int main (int argc, char **argv)
 	MPI_Init (&argc, &argv);
 	MPI_Comm_rank (MPI_COMM_WORLD, &me);
 #endif
+	if (arguments.metrics != NULL)
+		metrics_enable ();
+	if (arguments.counters && metrics_hardware () == 0 && me == 0)
+		fprintf (stderr,
+			 "No hardware counters (%s); going on without them\n",
+			 perfctr_error ());
+	if (arguments.trace != NULL)
+		trace_enable ();
 
 	/* Verify we can write to our output files before doing work */
 	outfile = fopen (arguments.args[1], "w");
@@ -131,15 +844,48 @@ int main (int argc, char **argv)
 	/* Only check on the ARFF file if we're writing it */
 	if (arguments.arff_out != NULL) {
 		arfffile = fopen (arguments.arff_out, "w");
-		if (outfile == NULL) {
+		if (arfffile == NULL) {
 			fprintf (stderr,
 				 "Could not open file for writing: %s\n",
-				 arguments.args[1]);
+				 arguments.arff_out);
 			return 1;
 		}
 	}
 
-	info = read_arff (arguments.args[0], arguments.class);
+	/* Out of core, only the header is held; the rows stay in the row
+	 * file, which rank 0 makes on first use.
+	 */
+	metrics_begin (PHASE_READ);
+	if (arguments.stream != NULL) {
+		int status = 0;
+
+		if (me == 0 && access (arguments.stream, F_OK) != 0)
+			status = rows_convert (arguments.args[0],
+					       arguments.class,
+					       arguments.stream);
+#ifndef NO_MPI
+		MPI_Bcast (&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#endif
+		if (status != 0) {
+			if (me == 0)
+				fprintf (stderr, "%s: %s, line %i\n",
+					 arguments.args[0], get_last_error (),
+					 get_lineno ());
+			return 1;
+		}
+
+		rows = rows_open (arguments.stream, arguments.class);
+		if (rows == NULL) {
+			fprintf (stderr, "%s: %s\n", arguments.stream,
+				 get_last_error ());
+			return 1;
+		}
+		info = rows->info;
+	} else {
+		info = load_arff (arguments.args[0], arguments.class,
+				  arguments.load_flags);
+	}
+	metrics_end (PHASE_READ);
 
 	if (info == NULL) {
 		fprintf (stderr, "%s, line %i\n", get_last_error (),
@@ -147,18 +893,28 @@ int main (int argc, char **argv)
 		return 1;
 	}
 
+	/* A partitioned load only holds a slice of the attributes; rank 0
+	 * needs all of their names to write the ranking.
+	 */
+	if (arguments.load_flags & LOAD_PARTITION) {
+		header = partition_header (info, &num_attributes);
+	} else {
+		header = info;
+		num_attributes = info->num_attributes;
+	}
+
 	/* Now that we know how many attributes there are, we can determine how
 	 * many to prune, if we're pruning a percentage.
 	 */
 	if (arguments.prune[strlen (arguments.prune) - 1] == '%') {
 		prune = (int) ((atof (arguments.prune) *
-				info->num_attributes) / 100);
+				num_attributes) / 100);
 	} else {
 		prune = atoi (arguments.prune);
 	}
 
 	/* Don't let's be silly. */
-	if (prune >= info->num_attributes) {
+	if (prune >= num_attributes) {
 		fprintf (stderr,
 			 "Attempting to prune entire file. Not bothering to run Relief-F.\n");
 		return 1;
@@ -167,39 +923,276 @@ int main (int argc, char **argv)
 	weights = calloc (info->num_attributes, sizeof (double));
 
 	resetOptions ();
-	setSampleSize (-1);
+	setSampleSize (arguments.sample);
+	setSeed (arguments.seed);
+	setSampleWithReplacement (arguments.replace);
+	setConvergence (arguments.converge, arguments.patience,
+			arguments.batch);
 	setNumNeighbours (10);
 	setWeightByDistance (true);
 	setSigma (2);
 	setVersion (arguments.algorithm);
 	setDifference (arguments.difference);
+	setDistanceCache (arguments.cache);
+	setDeduplicate (arguments.dedup);
+	setCollapseColumns (arguments.collapse);
+	setApproximate (arguments.lsh, arguments.lsh_bits);
+	setMetricTrees (arguments.vptree);
+	setSparseBelow (arguments.sparse);
+	setQuantize (arguments.quantize, arguments.rescore);
 
-	buildEvaluator (info, weights);
-	if (me == 0) {
+	if (rows != NULL) {
+		if (buildEvaluatorStreamed (rows, weights,
+					    (size_t) arguments.memory << 20) !=
+		    0) {
+			fprintf (stderr, "%s: %s\n", arguments.stream,
+				 get_last_error ());
+			return 1;
+		}
+		ranked = weights;
+	} else if (arguments.load_flags & LOAD_PARTITION) {
+		buildEvaluatorPartitioned (info, weights, arguments.batch);
+		ranked = (me == 0) ? calloc (num_attributes,
+					     sizeof (double)) : NULL;
+		partition_weights (info, weights, ranked);
+	} else if (arguments.permutations > 0) {
+		pvalues = calloc (num_attributes, sizeof (double));
+		if (buildEvaluatorPermutation (info, weights, pvalues,
+					       arguments.permutations) != 0) {
+			fprintf (stderr, "%s\n", get_last_error ());
+			return 1;
+		}
+		ranked = weights;
+	} else if (arguments.bootstrap > 0 || arguments.folds > 0) {
+		int scheme = (arguments.bootstrap > 0)
+			? RESAMPLE_BOOTSTRAP : RESAMPLE_FOLDS;
+		int count = (arguments.bootstrap > 0)
+			? arguments.bootstrap : arguments.folds;
+		double **replicates = calloc (count, sizeof (double *));
+		int r;
+
+		for (r = 0; r < count; r++)
+			replicates[r] = calloc (num_attributes,
+						sizeof (double));
+
+		if (buildEvaluatorResampled (info, scheme, count,
+					     replicates) != 0) {
+			fprintf (stderr, "%s\n", get_last_error ());
+			return 1;
+		}
+
+		if (me == 0
+		    && write_resampled (arguments.args[1],
+					(scheme == RESAMPLE_BOOTSTRAP)
+					? "boot" : "fold", outfile, header,
+					replicates, count, num_attributes,
+					num_attributes - 1 - prune,
+					arguments.top) != 0)
+			return 1;
+
+		for (r = 0; r < count; r++)
+			free (replicates[r]);
+		free (replicates);
+		written = true;
+		ranked = weights;
+	} else if (configs != NULL) {
+		double **sweep = calloc (num_configs, sizeof (double *));
+		int c;
+
+		for (c = 0; c < num_configs; c++)
+			sweep[c] = calloc (num_attributes, sizeof (double));
+
+		buildEvaluatorSweep (info, configs, num_configs, sweep);
+
+		/* One ranking file per setting; the rank file lists them */
+		for (c = 0; me == 0 && c < num_configs; c++) {
+			char *name = sweep_name (arguments.args[1],
+						 &configs[c]);
+			FILE *fp = fopen (name, "w");
+
+			if (fp == NULL) {
+				fprintf (stderr,
+					 "Could not open file for writing: %s\n",
+					 name);
+				return 1;
+			}
+			indices = rank_attributes (sweep[c], num_attributes,
+						   header->class_index);
+			write_ranking (fp, header, sweep[c], NULL, indices,
+				       num_attributes - 1 - prune);
+			fclose (fp);
+			free (indices);
+
+			fprintf (outfile, "%d,%d,%s\n", configs[c].knn,
+				 configs[c].sigma, name);
+			free (name);
+		}
+
+		for (c = 0; c < num_configs; c++)
+			free (sweep[c]);
+		free (sweep);
+		free (configs);
+		written = true;
+		ranked = weights;
+	} else if (arguments.state != NULL) {
+		relief_state_t *state = NULL;
+		FILE *fp = fopen (arguments.state, "rb");
+
+		/* No state file yet is a full run */
+		if (fp != NULL) {
+			fclose (fp);
+			state = read_state (arguments.state);
+			if (state == NULL) {
+				fprintf (stderr, "%s: %s\n", arguments.state,
+					 get_last_error ());
+				return 1;
+			}
+		}
+
+		state = buildEvaluatorIncremental (info, weights, state);
+
+		if (me == 0) {
+			printf ("Reused state for %d of %d instances\n",
+				getInstancesReused (), info->num_instances);
+			if (write_state (state, arguments.state) != 0) {
+				fprintf (stderr, "%s: %s\n", arguments.state,
+					 get_last_error ());
+				return 1;
+			}
+		}
+		release_state (state);
+
+		if (arguments.verify) {
+			double *full = calloc (num_attributes, sizeof (double));
+			double diff = 0, scale = 0;
+
+			buildEvaluator (info, full);
+			for (i = 0; me == 0 && i < num_attributes; i++) {
+				diff = fmax (diff, fabs (weights[i] - full[i]));
+				scale = fmax (scale, fabs (full[i]));
+			}
+			free (full);
+
+			if (me == 0) {
+				printf ("Verify: max difference from a full run %g\n",
+					diff);
+				if (diff > 1e-9 * (1 + scale)) {
+					fprintf (stderr,
+						 "Incremental update does not match a full run\n");
+					return 1;
+				}
+			}
+		}
+		ranked = weights;
+	} else {
+		int *active = NULL;
+		int count = num_attributes - 1, removed = 0, drop;
+
+		/* Iterated Relief-F (TuRF) keeps the data in memory and only
+		 * narrows the view of the attributes in use from round to round.
+		 */
+		if (arguments.turf > 0) {
+			active = calloc (num_attributes, sizeof (int));
+			for (i = count = 0; i < num_attributes; i++)
+				if (i != info->class_index)
+					active[count++] = i;
+		}
+
+		while (1) {
+			if (arguments.load_flags & LOAD_BLOCK) {
+				int rows, cols;
+
+				block_grid (&rows, &cols);
+				buildEvaluatorBlocked (info, weights, rows,
+						       cols);
+			} else {
+				buildEvaluator (info, weights);
+			}
+
+			if (active == NULL || removed >= prune)
+				break;
+
+			drop = (int) ceil (count * arguments.turf / 100);
+			if (drop > prune - removed)
+				drop = prune - removed;
+
+			/* Only rank 0 has the weights */
+			if (me == 0)
+				keep_best (active, count, weights,
+					   count - drop);
+#ifndef NO_MPI
+			MPI_Bcast (active, count - drop, MPI_INT, 0,
+				   MPI_COMM_WORLD);
+#endif
+			count -= drop;
+			removed += drop;
+			setActiveAttributes (active, count);
+		}
+
+		quantized = getQuantizedAttributes ();
+		if (arguments.compare
+		    && compare_exact (info, weights, arguments.top) != 0)
+			return 1;
+
+		/* Rank the dropped attributes below the survivors, which are
+		 * exactly the ones retained below.
+		 */
+		if (active != NULL) {
+			char *in_use = calloc (num_attributes, 1);
+
+			for (i = 0; i < count; i++)
+				in_use[active[i]] = 1;
+			for (i = 0; i < num_attributes; i++)
+				if (!in_use[i] && i != info->class_index)
+					weights[i] = -HUGE_VAL;
+
+			setActiveAttributes (NULL, 0);
+			free (in_use);
+			free (active);
+		}
+		ranked = weights;
+	}
+
+	if (me == 0 && arguments.converge > 0)
+		printf ("Used %d of %d instances\n", getInstancesUsed (),
+			info->num_instances);
+	if (me == 0 && arguments.dedup)
+		printf ("Distinct instances: %d of %d\n",
+			getDistinctInstances (), info->num_instances);
+	if (me == 0 && arguments.lsh > 0)
+		printf ("Approximate neighbours: %.1f candidates per query of %d instances\n",
+			getCandidatesPerQuery (), info->num_instances);
+	if (me == 0 && arguments.quantize)
+		printf ("Quantized %d numeric attributes to a byte each%s\n",
+			quantized,
+			(arguments.rescore) ? ", rescoring the neighbours" : "");
+	if (me == 0 && getSparseUsed ())
+		printf ("Distances merged deviations from the column modes (density below %g)\n",
+			arguments.sparse);
+	if (me == 0 && arguments.vptree) {
+		double built, visited, computed;
+
+		getTreeCounters (&built, &visited, &computed);
+		printf ("Metric trees: built with %.0f distances; per query %.1f nodes visited, %.1f distances of %d\n",
+			built, visited, computed, info->num_instances - 1);
+	}
+	if (me == 0 && arguments.collapse)
+		printf ("Distinct attributes: %d of %d\n",
+			getDistinctAttributes (), num_attributes - 1);
+
+	if (me == 0 && !written) {
 		/* The number of attributes retained includes neither the class
 		 * attribute nor the pruned attributes.
 		 */
-		int retained = info->num_attributes - 1 - prune;
-
-		/* Rank the attributes, but remove the class attribute. */
-		int *tmp = calloc (info->num_attributes, sizeof (int));
-		index_sort (tmp, weights, info->num_attributes);
-		indices =
-			remove_int (tmp, info->num_attributes,
-				    info->class_index);
-
-		/* In case we've gone crazy, fall back to original behavior */
-		if (indices == NULL)
-			indices = tmp;
-		else
-			free (tmp);
-
-		/* We generate a two-columned CSV */
-		for (i = 0; i < retained; i++) {
-			fprintf (outfile, "%s,%.3f\n",
-				 info->attributes[indices[i]]->name,
-				 evaluateAttribute (indices[i]));
-		}
+		int retained = num_attributes - 1 - prune;
+
+		metrics_begin (PHASE_RANK);
+		indices = rank_attributes (ranked, num_attributes,
+					   header->class_index);
+		metrics_end (PHASE_RANK);
+		metrics_begin (PHASE_OUTPUT);
+		write_ranking (outfile, header, ranked, pvalues, indices,
+			       retained);
 
 		/* Automatically generate an ARFF file, if requested.
 		 * This is primarily useful if we are pruning, for instance, for
@@ -301,11 +1294,33 @@ int main (int argc, char **argv)
 			}
 			free (output.instances);
 		}
+		metrics_end (PHASE_OUTPUT);
 
 		free (indices);
 	}
 
-	release_read_info (info);
+	if (arguments.metrics != NULL
+	    && metrics_write (arguments.metrics, arguments.args[0],
+			      info->num_instances, num_attributes) != 0) {
+		fprintf (stderr, "%s: %s\n", arguments.metrics,
+			 get_last_error ());
+		return 1;
+	}
+	if (arguments.trace != NULL && trace_write (arguments.trace) != 0) {
+		fprintf (stderr, "%s: %s\n", arguments.trace,
+			 get_last_error ());
+		return 1;
+	}
+
+	if (header != NULL && header != info)
+		release_read_info (header);
+	if (ranked != weights)
+		free (ranked);
+	free (pvalues);
+	if (rows != NULL)
+		rows_close (rows);
+	else
+		unload_arff (info);
 	free (weights);
 
 #ifndef NO_MPI
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "arff.h"
+#include "metrics.h"
+#include "perfctr.h"
+#include "trace.h"
+#ifndef NO_MPI
+#include "mpi.h"
+#endif
+
+/* The summary is one JSON object: the run's shape, its wall-clock time,
+ * each phase's time across the ranks (the slowest rank's, the mean, the
+ * fastest's, and the slowest over the mean as the imbalance) with the
+ * number of times it was entered, and the counters summed over the ranks
+ * with the rates derived from them.  With the hardware counters, it also
+ * has their counts in each phase, summed over the ranks, with the
+ * instructions per cycle and the events per distance derived from them.
+ */
+
+static const char *phase_names[NUM_PHASES] = {
+	"read", "minmax", "search", "update", "reduce", "rank", "output"
+};
+
+static const char *counter_names[NUM_COUNTERS] = {
+	"distances", "abandoned", "bytes"
+};
+
+static const char *hw_names[NUM_HW] = {
+	"cycles", "instructions", "llc_misses", "branch_misses"
+};
+
+static int enabled;
+static double started;
+static double begun[NUM_PHASES];
+static double seconds[NUM_PHASES];
+static double entries[NUM_PHASES];
+static double counts[NUM_COUNTERS];
+static int hardware;		/* counters asked for (on every rank) */
+static int hw_mask;		/* those open on this rank */
+static double hw_begun[NUM_PHASES][NUM_HW];
+static double hw[NUM_PHASES][NUM_HW];
+
+/* Wall-clock seconds from an arbitrary start */
+double metrics_now (void)
+{
+#ifdef NO_MPI
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+	return MPI_Wtime ();
+#endif
+}
+
+/**
+ * Starts recording, the run's wall-clock time counting from here.
+ */
+void metrics_enable (void)
+{
+	enabled = 1;
+	started = metrics_now ();
+}
+
+/**
+ * Counts the hardware events of the calling thread in each phase from here
+ * on, as far as the machine allows; every rank must call it, or none.
+ * Returns a mask of the counters open on this rank (see perfctr_open).
+ */
+int metrics_hardware (void)
+{
+	hardware = 1;
+	hw_mask = perfctr_open ();
+	return hw_mask;
+}
+
+int metrics_enabled (void)
+{
+	return enabled;
+}
+
+/* Phases are also spans of the trace, if it is on (see trace.h) */
+void metrics_begin (metrics_phase_t phase)
+{
+	if (enabled) {
+		begun[phase] = metrics_now ();
+		if (hw_mask != 0)
+			perfctr_read (hw_begun[phase]);
+	}
+	trace_begin ((trace_span_t) phase);
+}
+
+void metrics_end (metrics_phase_t phase)
+{
+	double now[NUM_HW];
+	int c;
+
+	if (enabled) {
+		seconds[phase] += metrics_now () - begun[phase];
+		entries[phase]++;
+		if (hw_mask != 0) {
+			perfctr_read (now);
+			for (c = 0; c < NUM_HW; c++)
+				hw[phase][c] += now[c] - hw_begun[phase][c];
+		}
+	}
+	trace_end ((trace_span_t) phase);
+}
+
+void metrics_count (metrics_counter_t counter, double n)
+{
+	if (enabled)
+		counts[counter] += n;
+}
+
+/* Writes a string as a JSON string */
+static void write_string (FILE * fp, char *s)
+{
+	fputc ('"', fp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf (fp, "\\%c", *s);
+		else if ((unsigned char) *s < 0x20)
+			fprintf (fp, "\\u%04x", *s);
+		else
+			fputc (*s, fp);
+	}
+	fputc ('"', fp);
+}
+
+/* A ratio, or 0 where it has no denominator */
+static double ratio (double a, double b)
+{
+	return (b > 0) ? a / b : 0;
+}
+
+/* Writes the hardware counts, summed over the ranks; a counter is given
+ * only if it was open on every rank.
+ */
+static void write_hardware (FILE * fp, double totals[][NUM_HW],
+			    int *open, int ranks, double distances)
+{
+	double sum[NUM_HW];
+	int p, c, k, have[NUM_HW];
+
+	for (c = 0, k = 0; c < NUM_HW; c++)
+		have[c] = (open[c] == ranks);
+	fprintf (fp, "  \"hardware\": {\"counters\": [");
+	for (c = 0; c < NUM_HW; c++)
+		if (have[c])
+			fprintf (fp, "%s\"%s\"", (k++ > 0) ? ", " : "",
+				 hw_names[c]);
+	fprintf (fp, "]");
+	if (k == 0) {
+		fprintf (fp, ", \"error\": ");
+		write_string (fp, perfctr_error ());
+		fprintf (fp, "}\n");
+		return;
+	}
+
+	memset (sum, 0, sizeof (sum));
+	fprintf (fp, ",\n    \"phases\": {\n");
+	for (p = 0; p < NUM_PHASES; p++) {
+		fprintf (fp, "      \"%s\": {", phase_names[p]);
+		for (c = 0, k = 0; c < NUM_HW; c++) {
+			if (!have[c])
+				continue;
+			fprintf (fp, "%s\"%s\": %.0f", (k++ > 0) ? ", " : "",
+				 hw_names[c], totals[p][c]);
+			sum[c] += totals[p][c];
+		}
+		if (have[HW_CYCLES] && have[HW_INSTRUCTIONS])
+			fprintf (fp, ", \"ipc\": %.3f",
+				 ratio (totals[p][HW_INSTRUCTIONS],
+					totals[p][HW_CYCLES]));
+		fprintf (fp, "}%s\n", (p < NUM_PHASES - 1) ? "," : "");
+	}
+	fprintf (fp, "    }");
+
+	if (have[HW_CYCLES] && have[HW_INSTRUCTIONS])
+		fprintf (fp, ",\n    \"ipc\": %.3f",
+			 ratio (sum[HW_INSTRUCTIONS], sum[HW_CYCLES]));
+	// the distances are all computed in the searches
+	for (c = 0; c < NUM_HW; c++)
+		if (have[c] && c != HW_INSTRUCTIONS)
+			fprintf (fp, ",\n    \"%s_per_distance\": %.3f",
+				 hw_names[c],
+				 ratio (totals[PHASE_SEARCH][c], distances));
+	fprintf (fp, "\n  }\n");
+}
+
+/**
+ * Gathers every rank's metrics and writes the summary to the named file
+ * on rank 0; every rank must call it.  Returns 0, or -1 with the error
+ * set (see get_last_error) if the file cannot be written.
+ */
+int metrics_write (char *filename, char *data, int instances,
+		   int attributes)
+{
+	double local[NUM_PHASES + 1], lo[NUM_PHASES + 1], hi[NUM_PHASES + 1];
+	double sum[NUM_PHASES + 1], n[NUM_PHASES], total[NUM_COUNTERS];
+	double hw_total[NUM_PHASES][NUM_HW];
+	double mean;
+	int p, me = 0, ranks = 1, r = 0;
+	int open[NUM_HW], hw_open[NUM_HW];
+	FILE *fp;
+
+	for (p = 0; p < NUM_HW; p++)
+		open[p] = (hw_mask >> p) & 1;
+	perfctr_close ();
+	hw_mask = 0;
+	memcpy (local, seconds, sizeof (seconds));
+	local[NUM_PHASES] = metrics_now () - started;
+#ifdef NO_MPI
+	memcpy (lo, local, sizeof (local));
+	memcpy (hi, local, sizeof (local));
+	memcpy (sum, local, sizeof (local));
+	memcpy (n, entries, sizeof (entries));
+	memcpy (total, counts, sizeof (counts));
+	memcpy (hw_total, hw, sizeof (hw));
+	memcpy (hw_open, open, sizeof (open));
+#else
+	MPI_Comm_rank (MPI_COMM_WORLD, &me);
+	MPI_Comm_size (MPI_COMM_WORLD, &ranks);
+	MPI_Reduce (local, lo, NUM_PHASES + 1, MPI_DOUBLE, MPI_MIN, 0,
+		    MPI_COMM_WORLD);
+	MPI_Reduce (local, hi, NUM_PHASES + 1, MPI_DOUBLE, MPI_MAX, 0,
+		    MPI_COMM_WORLD);
+	MPI_Reduce (local, sum, NUM_PHASES + 1, MPI_DOUBLE, MPI_SUM, 0,
+		    MPI_COMM_WORLD);
+	MPI_Reduce (entries, n, NUM_PHASES, MPI_DOUBLE, MPI_SUM, 0,
+		    MPI_COMM_WORLD);
+	MPI_Reduce (counts, total, NUM_COUNTERS, MPI_DOUBLE, MPI_SUM, 0,
+		    MPI_COMM_WORLD);
+	if (hardware) {
+		MPI_Reduce (hw, hw_total, NUM_PHASES * NUM_HW, MPI_DOUBLE,
+			    MPI_SUM, 0, MPI_COMM_WORLD);
+		MPI_Reduce (open, hw_open, NUM_HW, MPI_INT, MPI_SUM, 0,
+			    MPI_COMM_WORLD);
+	}
+#endif
+	if (me != 0)
+		return 0;
+
+	fp = fopen (filename, "w");
+	if (fp == NULL) {
+		set_last_error ("Could not open metrics file for writing", 0);
+		return -1;
+	}
+
+	fprintf (fp, "{\n  \"data\": ");
+	write_string (fp, data);
+	fprintf (fp, ",\n  \"instances\": %d,\n  \"attributes\": %d,\n",
+		 instances, attributes);
+	fprintf (fp, "  \"ranks\": %d,\n  \"wall_seconds\": %.6f,\n", ranks,
+		 hi[NUM_PHASES]);
+
+	fprintf (fp, "  \"phases\": {\n");
+	for (p = 0; p < NUM_PHASES; p++) {
+		mean = sum[p] / ranks;
+		fprintf (fp, "    \"%s\": {\"seconds\": %.6f, \"mean\": %.6f, \"min\": %.6f, \"imbalance\": %.4f, \"entries\": %.0f}%s\n",
+			 phase_names[p], hi[p], mean, lo[p],
+			 (mean > 0) ? hi[p] / mean : 1.0, n[p],
+			 (p < NUM_PHASES - 1) ? "," : "");
+	}
+	fprintf (fp, "  },\n");
+
+	fprintf (fp, "  \"counters\": {");
+	for (p = 0; p < NUM_COUNTERS; p++)
+		fprintf (fp, "%s\"%s\": %.0f", (p > 0) ? ", " : "",
+			 counter_names[p], total[p]);
+	fprintf (fp, "},\n");
+
+	fprintf (fp, "  \"rates\": {\"queries\": %.0f, \"distances_per_second\": %.1f, \"abandon_rate\": %.4f, \"bytes_per_distance\": %.1f}%s\n",
+		 n[PHASE_SEARCH],
+		 ratio (total[COUNT_DISTANCES], sum[PHASE_SEARCH] / ranks),
+		 ratio (total[COUNT_ABANDONED], total[COUNT_DISTANCES]),
+		 ratio (total[COUNT_BYTES], total[COUNT_DISTANCES]),
+		 hardware ? "," : "");
+	if (hardware)
+		write_hardware (fp, hw_total, hw_open, ranks,
+				total[COUNT_DISTANCES]);
+	fprintf (fp, "}\n");
+
+	if (ferror (fp))
+		r = -1;
+	if (fclose (fp) != 0)
+		r = -1;
+	if (r != 0)
+		set_last_error ("Could not write metrics file", 0);
+	return r;
+}
@@ -0,0 +1,40 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/* Run metrics: the wall-clock time spent in each phase of a run, and
+ * counters of the work done, kept per rank and summed over the run, for a
+ * machine-readable summary at the end (see metrics_write).  Until
+ * metrics_enable, recording a phase costs a test and nothing else.  The
+ * phases are also spans of the trace, if it is on (see trace.h), and with
+ * metrics_hardware they count the hardware events in them (see perfctr.h).
+ */
+
+typedef enum {
+	PHASE_READ,		/* reading and parsing the data */
+	PHASE_MINMAX,		/* the pass for the numeric attribute ranges */
+	PHASE_SEARCH,		/* neighbour searches, one entry per query */
+	PHASE_UPDATE,		/* weight updates, likewise */
+	PHASE_REDUCE,		/* reductions across the ranks */
+	PHASE_RANK,		/* ranking the attributes */
+	PHASE_OUTPUT,		/* writing the results */
+	NUM_PHASES
+} metrics_phase_t;
+
+typedef enum {
+	COUNT_DISTANCES,	/* distances computed, in full or cut short */
+	COUNT_ABANDONED,	/* distances cut short at a bound */
+	COUNT_BYTES,		/* bytes of candidate rows the distances read */
+	NUM_COUNTERS
+} metrics_counter_t;
+
+void metrics_enable (void);
+int metrics_hardware (void);
+int metrics_enabled (void);
+double metrics_now (void);
+void metrics_begin (metrics_phase_t phase);
+void metrics_end (metrics_phase_t phase);
+void metrics_count (metrics_counter_t counter, double n);
+int metrics_write (char *filename, char *data, int instances,
+		   int attributes);
+
+#endif
@@ -0,0 +1,120 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "perfctr.h"
+
+static int fds[NUM_HW] = { -1, -1, -1, -1 };
+static int leader = -1;		/* the group's first counter, if any */
+static int order[NUM_HW];	/* the counters, in the group's order */
+static int open_count;
+static char error[128] = "not opened";
+
+#ifdef __linux__
+static const uint64_t configs[NUM_HW] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/* Notes why a counter failed to open, from the errno */
+static void set_error (int e)
+{
+	if (e == ENOENT || e == EOPNOTSUPP)
+		strcpy (error, "the machine does not offer it");
+	else if (e == EACCES || e == EPERM)
+		strcpy (error,
+			"not permitted, see /proc/sys/kernel/perf_event_paranoid");
+	else if (e == ENOSYS)
+		strcpy (error, "the kernel has no perf_event_open");
+	else
+		strncpy (error, strerror (e), sizeof (error) - 1);
+}
+#endif
+
+/**
+ * Opens what it can of the counters on the calling thread and starts
+ * them.  Returns a mask of those open, bit i for counter i; with none,
+ * perfctr_error says why.
+ */
+int perfctr_open (void)
+{
+	int mask = 0;
+#ifdef __linux__
+	struct perf_event_attr attr;
+	int c;
+
+	for (c = 0; c < NUM_HW; c++) {
+		memset (&attr, 0, sizeof (attr));
+		attr.size = sizeof (attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[c];
+		attr.disabled = (leader < 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP |
+			PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fds[c] = syscall (SYS_perf_event_open, &attr, 0, -1, leader, 0);
+		if (fds[c] < 0) {
+			set_error (errno);
+			continue;
+		}
+		if (leader < 0)
+			leader = fds[c];
+		order[open_count++] = c;
+		mask |= 1 << c;
+	}
+	if (leader >= 0)
+		ioctl (leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+	strcpy (error, "not supported on this system");
+#endif
+	return mask;
+}
+
+/**
+ * Reads the counts so far into counts, indexed by counter, scaled up for
+ * any time the group spent off the machine; those not open read as 0.
+ */
+void perfctr_read (double *counts)
+{
+	uint64_t buf[3 + NUM_HW];
+	double scale = 1;
+	int i;
+
+	memset (counts, 0, sizeof (double) * NUM_HW);
+	if (leader < 0
+	    || read (leader, buf, sizeof (uint64_t) * (3 + open_count)) <= 0)
+		return;
+	// buf: the number of counters, the time enabled and running, counts
+	if (buf[2] > 0 && buf[2] < buf[1])
+		scale = (double) buf[1] / buf[2];
+	for (i = 0; i < open_count && i < (int) buf[0]; i++)
+		counts[order[i]] = buf[3 + i] * scale;
+}
+
+void perfctr_close (void)
+{
+	int c;
+
+	for (c = 0; c < NUM_HW; c++) {
+		if (fds[c] >= 0)
+			close (fds[c]);
+		fds[c] = -1;
+	}
+	leader = -1;
+	open_count = 0;
+}
+
+/* Why the last counter failed to open */
+char *perfctr_error (void)
+{
+	return error;
+}
@@ -0,0 +1,25 @@
+#ifndef _PERFCTR_H
+#define _PERFCTR_H
+
+/* Hardware performance counters of the calling thread, counted in user
+ * space through perf_event_open on Linux.  The counters open as one group,
+ * so they are read together and scaled alike when the kernel has to
+ * multiplex them.  Any the kernel or the machine does not offer (in many
+ * virtual machines, none) read as unavailable, and the rest go on without
+ * them.
+ */
+
+typedef enum {
+	HW_CYCLES,
+	HW_INSTRUCTIONS,
+	HW_LLC_MISSES,		/* last-level cache misses */
+	HW_BRANCH_MISSES,
+	NUM_HW
+} perfctr_t;
+
+int perfctr_open (void);
+void perfctr_read (double *counts);
+void perfctr_close (void);
+char *perfctr_error (void);
+
+#endif
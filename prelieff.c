@@ -9,19 +9,37 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include <limits.h>
+#include <stdint.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 #include "arff.h"
 #include "java.h"
 #include "index_sort.h"
 #include "util.h"
+#include "rng.h"
+#include "state.h"
+#include "dcache.h"
+#include "rows.h"
+#include "lsh.h"
+#include "vptree.h"
+#include "metrics.h"
+#include "trace.h"
+#include "prelieff.h"
 #ifndef NO_MPI
 #include "mpi.h"
 #endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define SMALL       1e-6
 #define EQ(a,b)     (((a-b)<SMALL) && ((b-a)<SMALL))
 
+/** Queries (and candidates) per tile of a distance block */
+#define BLOCK_TILE  64
+
 /** The training instances */
 static arff_info_t *m_trainInstances;
 
@@ -80,6 +98,158 @@ static int *m_stored;
 /** Random number seed used for sampling instances */
 static int m_seed;
 
+/** Sample instances with replacement (otherwise each at most once) */
+static boolean m_replace;
+
+/** Draws the sampled instances, see sampleInstance */
+static rng_perm_t m_sampler;
+
+/**
+  * Convergence mode: stop sampling once the top m_convergeK attributes have
+  * stayed the same for m_patience checks, one every m_checkEvery instances.
+  * Off when m_convergeK is 0.
+  */
+static int m_convergeK;
+static int m_patience;
+static int m_checkEvery;
+
+/** Checks in a row with an unchanged top-K, and the top-K at the last one */
+static int m_stableChecks;
+static int *m_lastTop;
+
+/** Instances processed by the last build */
+static int m_instancesUsed;
+
+/** Instances the last incremental build took over from its saved state */
+static int m_instancesReused;
+
+/** Class labels to use instead of the data's, or null (see accumulateQuery) */
+static int *m_labels;
+
+/**
+  * For the integer kernel (see packCodes): the nominal values of the
+  * attributes in use, a byte each, per instance; the attribute of each
+  * column; and the class of each instance.
+  */
+static unsigned char *m_codes;
+static int *m_coded;
+static int m_numCoded;
+static int *m_codeLabels;
+
+/** Columns between the early-abandonment checks of boundedDistance */
+#define CODE_TILE	64
+
+/** Fixed-point one, for the integer kernel's weight sums */
+#define FIXED_ONE	4294967296.0
+
+/** Bins of a quantized numeric attribute, less one */
+#define QUANT_BINS	255
+
+/** Default density below which the integer kernel goes sparse */
+#define SPARSE_BELOW	0.05
+
+/** Number of neighbour_t in a row of a neighbour table */
+static int m_rowLength;
+
+/**
+  * The instances by class: class c's are m_classMembers[m_classStart[c]]
+  * up to, not including, m_classStart[c + 1], in index order, so that a
+  * search can scan each class in a loop of its own against that class's
+  * k-th nearest so far (see findKHitMiss).  Null without the rows.
+  */
+static int *m_classStart;
+static int *m_classMembers;
+
+/**
+  * Deduplication: identical rows (class included) are grouped, group g's
+  * members being m_groupMembers[m_groupStart[g]] up to, not including,
+  * m_groupStart[g + 1], in index order, the first standing for the rest.
+  * m_groupOf is null when the rows are not grouped.
+  */
+static boolean m_dedup;
+static int m_numGroups;
+static int *m_groupOf;
+static int *m_groupStart;
+static int *m_groupMembers;
+
+/**
+  * Column collapsing: of identical attribute columns in use, only the first
+  * stays in the view (see m_attributeRank), counting m_columnCount[a] times
+  * in distances; m_columnOf[a] is the attribute standing for a, or -1 for
+  * one not in use.  m_columnOf is null when the columns are not collapsed.
+  */
+static boolean m_collapse;
+static int m_numDistinctColumns;
+static int *m_columnOf;
+static int *m_columnCount;
+static unsigned int *m_codeCounts;
+
+/**
+  * Sparse form of the packed values, used when less than m_sparseBelow of
+  * them differ from their column's mode (m_codeModes): instance i's
+  * deviations are columns m_devColumns and values m_devValues from
+  * m_devStart[i] up to m_devStart[i + 1], in column order, and m_devSelf[i]
+  * sums their differences from the modes.  m_codeModes is null when the
+  * values are dense.
+  */
+static double m_sparseBelow;
+static boolean m_sparseUsed;
+static unsigned char *m_codeModes;
+static size_t *m_devStart;
+static int *m_devColumns;
+static unsigned char *m_devValues;
+static unsigned int *m_devSelf;
+
+/**
+  * Approximate neighbours: with m_lshTables > 0, buildEvaluator takes each
+  * query's neighbours from the instances sharing its key in any of
+  * m_lshTables hash tables, keyed by m_lshBits sampled attributes each
+  * (see lshKeys).
+  */
+static int m_lshTables;
+static int m_lshBits;
+static lsh_index_t *m_lsh;
+static int *m_lshStamp;
+static int m_lshSearches;
+static int *m_classCounts;
+static double m_lshExamined;
+static double m_lshCandidates;
+
+/**
+  * Metric trees: with m_useTrees, buildEvaluator finds each query's exact
+  * neighbours by searching a vantage-point tree per class, m_trees, built
+  * over the data in use.  The counters add up over a build's queries.
+  */
+static boolean m_useTrees;
+static vp_tree_t **m_trees;
+static double m_treeBuilt;
+static double m_treeVisited;
+static double m_treeComputed;
+
+/**
+  * Quantization: with m_quantize, the integer kernel also packs numeric
+  * attributes, each binned over its range to a byte.  They come first in a
+  * packed row, m_numQuant of them, and a nominal difference counts
+  * m_codeScale bins.  With m_rescore, the neighbours found are rescored at
+  * full precision before they update the weights.
+  */
+static boolean m_quantize;
+static boolean m_rescore;
+static int m_numQuant;
+static unsigned int m_codeScale;
+
+/**
+  * The work of the bounded searches (see findKHitMiss) in the current
+  * build: distances computed, those cut short, and the bytes of candidate
+  * rows read, handed to the metrics at its end.
+  */
+static double m_scanDistances;
+static double m_scanAbandoned;
+static double m_scanBytes;
+
+/** Directory of the distance cache files, or null (see distanceCache) */
+static char *m_cacheDir;
+
 /**
   *  used to (optionally) weight nearest neighbours by their distance
   *  from the instance in question. Each entry holds 
@@ -97,18 +267,71 @@ static double m_totalTime;
 
 static double *tempDistClass;
 static double *tempDistAtt;
+static double *tempTieClass;
+static double *tempTieAtt;
+static double *tempWeights;
 static int *tempSortedClass;
 static int **tempSortedAtt;
 static double *distNormAtt;
 static int *m_attributeRank;
 static int m_numExcludedAttributes;
 
+/** Number of attributes in m_attributeRank */
+static int m_numUsed;
+
+/** The attributes to use, or null for all (see setActiveAttributes) */
+static int *m_active;
+static int m_numActive;
+
 static int m_version = 0;	// version of the algorithm to use
 int m_difference = 0;
 
+double norm (double x, int i);
 void updateMinMax (instance_t * instance);
+double distance (instance_t * first, instance_t * second);
+double difference (int index, data_t * dat1, data_t * dat2);
+static double distanceBounded (instance_t * first, instance_t * second,
+			       double bound);
+static void bucketClasses ();
 void findKHitMiss (int instNum);
+void insertKHitMiss (int i, double temp_diff);
 void updateWeightsDiscreteClass (int instNum);
+static dist_cache_t *distanceCache (int first, int stride, boolean all);
+static void neighboursFromCache (dist_cache_t * cache, int r,
+				 int *members, int *classCounts,
+				 neighbour_t * lists);
+static void karrayFromCache (dist_cache_t * cache, int q, int *classCounts,
+			     neighbour_t * lists);
+static boolean packCodes ();
+static boolean everywhere (boolean ok);
+static void releaseCodes ();
+static void packSparse ();
+static void releaseSparse ();
+static unsigned int codedDistance (int a, int b);
+static unsigned int boundedDistance (int a, int b, unsigned int bound);
+static void fixedSearch (int q, neighbour_t * lists);
+static void fixedAccumulate (int q, neighbour_t * lists, int times,
+			     int64_t * fixed);
+static void fixedToSums (int64_t * fixed, double *sums);
+static void accumulateQuery (int q, neighbour_t * lists, int k,
+			     double *byRank, double *sums, double sign);
+static void rescoreLists (int q, neighbour_t * lists);
+static void combineSums (double *sums, double *weights);
+static void sumsToWeights (double *sums, int total);
+static void collapseColumns ();
+static void fanOutColumns ();
+static void groupRows ();
+static void buildTrees ();
+static void releaseTrees (int total);
+static void treeSearch (int q, neighbour_t * lists);
+static void karrayFromLists (neighbour_t * lists);
+static void queryApproximate (int total, int my_rank, int num_nodes,
+			      neighbour_t * lists, int64_t * fixed,
+			      double *sums);
+static void releaseGroups ();
+static void groupSearch (int q, neighbour_t * lists);
+static void queryGroups (int total, int my_rank, int num_nodes,
+			 neighbour_t * lists, int64_t * fixed, double *sums);
 
 void setSigma (int s)
 {
@@ -125,77 +348,3333 @@ void setNumNeighbours (int n)
 	m_Knn = n;
 }
 
-int getNumNeighbours ()
-{
-	return m_Knn;
-}
+int getNumNeighbours ()
+{
+	return m_Knn;
+}
+
+void setSeed (int s)
+{
+	m_seed = s;
+}
+
+int getSeed ()
+{
+	return m_seed;
+}
+
+void setSampleSize (int s)
+{
+	m_sampleM = s;
+}
+
+int getSampleSize ()
+{
+	return m_sampleM;
+}
+
+void setSampleWithReplacement (boolean b)
+{
+	m_replace = b;
+}
+
+boolean getSampleWithReplacement ()
+{
+	return m_replace;
+}
+
+void setWeightByDistance (boolean b)
+{
+	m_weightByDistance = b;
+}
+
+boolean getWeightByDistance ()
+{
+	return m_weightByDistance;
+}
+
+double getTotalTime ()
+{
+	return m_totalTime;
+}
+
+void setVersion (int version)
+{
+	m_version = version;
+}
+
+void setDifference (int difference)
+{
+	m_difference = difference;
+}
+
+/**
+  * Turns on convergence mode (k > 0) or off (k == 0).  Instances are then
+  * processed in random order, and sampling stops early once the k best
+  * attributes are the same at patience successive checks, taken every
+  * check instances.
+  *
+  * @param k the number of top attributes to watch
+  * @param patience the number of unchanged checks to stop after
+  * @param check the number of instances between checks
+  */
+void setConvergence (int k, int patience, int check)
+{
+	m_convergeK = k;
+	m_patience = patience;
+	m_checkEvery = check;
+}
+
+/**
+  * The number of instances the last build processed, which is less than
+  * the sample size if it converged.
+  */
+int getInstancesUsed ()
+{
+	return m_instancesUsed;
+}
+
+/**
+  * Turns deduplication on or off.  With it on, buildEvaluator collapses
+  * identical instances into one, processed once as a query and once per
+  * query as a candidate neighbour, counting for as many as it stands for:
+  * the weights come out as without it, at a cost that falls with the
+  * number of distinct instances.
+  *
+  * @param b whether to deduplicate
+  */
+void setDeduplicate (boolean b)
+{
+	m_dedup = b;
+}
+
+/**
+  * The number of distinct instances the last deduplicated build found.
+  */
+int getDistinctInstances ()
+{
+	return m_numGroups;
+}
+
+/**
+  * Turns column collapsing on or off.  With it on, identical attribute
+  * columns are scored as one, counted as many times in the distances, and
+  * the weight of each goes to all of them.
+  *
+  * @param b whether to collapse identical columns
+  */
+void setCollapseColumns (boolean b)
+{
+	m_collapse = b;
+}
+
+/**
+  * The number of distinct attribute columns the last collapsed build kept.
+  */
+int getDistinctAttributes ()
+{
+	return m_numDistinctColumns;
+}
+
+/**
+  * Turns approximate neighbours on (tables > 0) or off (tables == 0).
+  * More tables find more of the true neighbours, more bits per key make
+  * the buckets smaller and the search faster.
+  *
+  * @param tables the number of hash tables
+  * @param bits the number of sampled attributes per key
+  */
+void setApproximate (int tables, int bits)
+{
+	m_lshTables = tables;
+	m_lshBits = bits;
+}
+
+/**
+  * The mean number of instances the last approximate build examined per
+  * query, out of all of them for an exact search.
+  */
+double getCandidatesPerQuery ()
+{
+	return m_lshCandidates;
+}
+
+/**
+  * Sets the density below which the integer kernel keeps instances as
+  * their deviations from each column's most common value, and computes
+  * distances by merging those, at a cost in proportion to the deviations
+  * rather than the attributes.
+  *
+  * @param density the share of values differing from their column's mode,
+  * 0 for never
+  */
+void setSparseBelow (double density)
+{
+	m_sparseBelow = density;
+}
+
+/**
+  * Whether the last build with the integer kernel used the sparse form.
+  */
+boolean getSparseUsed ()
+{
+	return m_sparseUsed;
+}
+
+/**
+  * Turns quantization (see m_quantize) on or off.  The neighbours are then
+  * the nearest at a byte's precision per numeric attribute, which may not
+  * be quite those of a full-precision search.
+  *
+  * @param rescore whether to order the neighbours found, and take their
+  * differences, at full precision
+  */
+void setQuantize (boolean b, boolean rescore)
+{
+	m_quantize = b;
+	m_rescore = b && rescore;
+}
+
+/**
+  * The number of numeric attributes the last build quantized.
+  */
+int getQuantizedAttributes ()
+{
+	return m_numQuant;
+}
+
+/**
+  * Turns the metric trees (see m_useTrees) on or off.  The distance is a
+  * metric, so a tree skips whatever the triangle inequality shows to be
+  * farther than the k nearest so far; the neighbours are exactly those of
+  * a full search.
+  *
+  * @param b whether to search metric trees
+  */
+void setMetricTrees (boolean b)
+{
+	m_useTrees = b;
+}
+
+/**
+  * The counters of the last build with metric trees: the distances
+  * computed building the trees, and per query, the tree nodes visited and
+  * the distances computed.
+  */
+void getTreeCounters (double *built, double *visited, double *computed)
+{
+	*built = m_treeBuilt;
+	*visited = m_treeVisited;
+	*computed = m_treeComputed;
+}
+
+/**
+  * The number of instances the last incremental build did not have to
+  * redo, as they were covered by its saved state.
+  */
+int getInstancesReused ()
+{
+	return m_instancesReused;
+}
+
+/**
+  * Restricts the evaluator to a view of the attributes: distances and
+  * weight updates use only these, and the others keep a weight of 0.
+  * The instances themselves are left alone.  The list is the caller's and
+  * must stay valid while the evaluator runs; null restores all attributes.
+  *
+  * @param active the indices of the attributes to use
+  * @param count the number of them
+  */
+void setActiveAttributes (int *active, int count)
+{
+	m_active = active;
+	m_numActive = count;
+}
+
+/**
+  * Keeps the distances in cache files in a directory, for later runs over
+  * the same data and settings to map instead of recompute (see
+  * distanceCache); null turns this off.  The directory must be shared by
+  * all the ranks.
+  *
+  * @param dir the directory
+  */
+void setDistanceCache (char *dir)
+{
+	m_cacheDir = dir;
+}
+
+/**
+  * Sets up the evaluator's state for a set of instances: the attribute and
+  * instance tables, neighbour and sorting buffers, class priors and the
+  * numeric attribute ranges.  Weights accumulate directly in weights until
+  * the caller says otherwise.
+  *
+  * @param data set of instances serving as training data
+  * @param weights the final attribute weights
+  */
+void initEvaluator (arff_info_t * data, double *weights)
+{
+	int i, j;
+
+	m_trainInstances = data;
+	m_classIndex = m_trainInstances->class_index;
+	m_numAttribs = m_trainInstances->num_attributes;
+	m_numInstances = m_trainInstances->num_instances;
+	m_attributes = m_trainInstances->attributes;
+	m_instances = m_trainInstances->instances;
+
+	m_numClasses = m_attributes[m_classIndex]->nom_info->num_classes;
+
+	if (m_weightByDistance)	// set up the rank based weights
+	{
+		m_weightsByRank =
+			(double *) malloc_dbg (1, sizeof (double) * m_Knn);
+
+		for (i = 0; i < m_Knn; i++) {
+			m_weightsByRank[i] =
+				exp (-
+				     ((i / (double) m_sigma) *
+				      (i / (double) m_sigma)));
+		}
+	}
+	// the final attribute weights
+	m_weights = m_finalWeights = weights;
+
+	m_attributeRank = (int *) malloc_dbg (3, sizeof (int) * m_numAttribs);
+
+	if (m_active != null) {
+		memcpy (m_attributeRank, m_active, sizeof (int) * m_numActive);
+		m_numUsed = m_numActive;
+	} else {
+		for (i = 0; i < m_numAttribs; i++) {
+			m_attributeRank[i] = i;
+		}
+		m_numUsed = m_numAttribs;
+	}
+	m_numExcludedAttributes = 0;
+	if (m_collapse && m_instances != null) {
+		collapseColumns ();
+	}
+
+	for (i = 0; i < m_numAttribs; i++) {
+		m_weights[i] = m_finalWeights[i] = 0.0;
+	}
+	// num classes (1 for numeric class) knn neighbours, 
+	// and 0 = distance, 1 = instance index, 2 = tie-breaking index
+	m_karray =
+		(double ***) malloc_dbg (4,
+					 sizeof (double **) * m_numClasses);
+	for (i = 0; i < m_numClasses; i++) {
+		m_karray[i] =
+			(double **) malloc_dbg (5, sizeof (double *) * m_Knn);
+		for (j = 0; j < m_Knn; j++) {
+			m_karray[i][j] =
+				(double *) malloc_dbg (6,
+						       sizeof (double) * 3);
+		}
+	}
+
+	m_classProbs =
+		(double *) malloc_dbg (7, sizeof (double) * m_numClasses);
+	memset (m_classProbs, 0, sizeof (double) * m_numClasses);
+
+	// a header without rows (see buildEvaluatorStreamed) leaves the class
+	// priors and the ranges below to the caller
+	for (i = 0; m_instances != null && i < m_numInstances; i++) {
+		m_classProbs[m_instances[i]->data[m_classIndex].ival]++;
+	}
+
+	for (i = 0; i < m_numClasses; i++) {
+		m_classProbs[i] /= m_numInstances;
+	}
+	if (m_instances != null) {
+		bucketClasses ();
+	}
+
+	m_worst = (double *) malloc_dbg (8, sizeof (double) * m_numClasses);
+	m_index = (int *) malloc_dbg (9, sizeof (int) * m_numClasses);
+	m_stored = (int *) malloc_dbg (10, sizeof (int) * m_numClasses);
+	m_minArray =
+		(double *) malloc_dbg (11, sizeof (double) * m_numAttribs);
+	m_maxArray =
+		(double *) malloc_dbg (12, sizeof (double) * m_numAttribs);
+
+	// these are indexed by neighbour, not by attribute
+	tempDistClass = (double *) malloc_dbg (13, sizeof (double) * m_Knn);
+	tempDistAtt = (double *) malloc_dbg (14, sizeof (double) * m_Knn);
+	tempTieClass = (double *) malloc_dbg (19, sizeof (double) * m_Knn);
+	tempTieAtt = (double *) malloc_dbg (20, sizeof (double) * m_Knn);
+	tempWeights = (double *) malloc_dbg (103, sizeof (double) * m_Knn);
+	tempSortedClass = (int *) malloc_dbg (15, sizeof (int) * m_Knn);
+	tempSortedAtt =
+		(int **) malloc_dbg (16, sizeof (int *) * m_numClasses);
+	distNormAtt =
+		(double *) malloc_dbg (17, sizeof (double) * m_numClasses);
+
+	for (i = 0; i < m_numClasses; i++) {
+		tempSortedAtt[i] =
+			(int *) malloc_dbg (18, sizeof (int) * m_Knn);
+	}
+
+	for (i = 0; i < m_numAttribs; i++) {
+		m_minArray[i] = m_maxArray[i] = DBL_MAX;
+	}
+
+	metrics_begin (PHASE_MINMAX);
+	for (i = 0; m_instances != null && i < m_numInstances; i++) {
+		updateMinMax (m_instances[i]);
+	}
+	metrics_end (PHASE_MINMAX);
+}
+
+/**
+  * Frees everything initEvaluator set up, except the weights.
+  */
+void releaseEvaluator ()
+{
+	int i, j;
+
+	if (m_weightByDistance)
+		free (m_weightsByRank);
+	for (i = 0; i < m_numClasses; i++) {
+		for (j = 0; j < m_Knn; j++)
+			free (m_karray[i][j]);
+		free (m_karray[i]);
+	}
+	free (m_karray);
+	free (m_classProbs);
+	free (m_worst);
+	free (m_index);
+	free (m_stored);
+	free (m_minArray);
+	free (m_maxArray);
+
+	for (i = 0; i < m_numClasses; i++) {
+		free (tempSortedAtt[i]);
+	}
+
+	free (tempDistClass);
+	free (tempDistAtt);
+	free (tempTieClass);
+	free (tempTieAtt);
+	free (tempWeights);
+	free (tempSortedClass);
+	free (tempSortedAtt);
+	free (distNormAtt);
+	free (m_attributeRank);
+	free (m_columnOf);
+	free (m_columnCount);
+	free (m_classStart);
+	free (m_classMembers);
+	m_columnOf = null;
+	m_columnCount = null;
+	m_classStart = null;
+	m_classMembers = null;
+}
+
+/**
+  * Sorts the instances into their class ranges (see m_classStart), a
+  * counting sort, so each range stays in index order.
+  */
+static void bucketClasses ()
+{
+	int i, c;
+
+	m_classStart = (int *) malloc_dbg (151, sizeof (int) *
+					   (m_numClasses + 1));
+	m_classMembers = (int *) malloc_dbg (152, sizeof (int) *
+					     m_numInstances);
+	memset (m_classStart, 0, sizeof (int) * (m_numClasses + 1));
+	for (i = 0; i < m_numInstances; i++) {
+		m_classStart[m_instances[i]->data[m_classIndex].ival + 1]++;
+	}
+	for (c = 0; c < m_numClasses; c++) {
+		m_classStart[c + 1] += m_classStart[c];
+	}
+	// each class's start moves up to the next's as its members go in
+	for (i = 0; i < m_numInstances; i++) {
+		c = m_instances[i]->data[m_classIndex].ival;
+		m_classMembers[m_classStart[c]++] = i;
+	}
+	for (c = m_numClasses; c > 0; c--) {
+		m_classStart[c] = m_classStart[c - 1];
+	}
+	m_classStart[0] = 0;
+}
+
+/**
+  * Clears the knn and worst index stuff for the classes.
+  */
+void clearKHitMiss ()
+{
+	int j, k;
+
+	for (j = 0; j < m_numClasses; j++) {
+		m_index[j] = m_stored[j] = 0;
+
+		for (k = 0; k < m_Knn; k++) {
+			m_karray[j][k][0] = m_karray[j][k][1] =
+				m_karray[j][k][2] = 0;
+		}
+	}
+}
+
+/**
+  * Sets up sampling from a population of n instances.
+  */
+void initSampler (int n)
+{
+	rng_perm_init (&m_sampler, rng_key (m_seed), RNG_STREAM_SAMPLE, n);
+}
+
+/**
+  * Number of instances to process: all of them, or m_sampleM.
+  */
+int sampleCount ()
+{
+	if ((m_sampleM > m_sampler.n) || (m_sampleM < 0)) {
+		return m_sampler.n;
+	} else {
+		return m_sampleM;
+	}
+}
+
+/**
+  * The instance to process at step s, 0 <= s < sampleCount ().  A sample
+  * draw depends only on the seed and s, never on which rank takes the step,
+  * so any split of the steps processes the same instances.
+  */
+int sampleInstance (int s)
+{
+	if (sampleCount () == m_sampler.n && m_convergeK == 0) {
+		return s;
+	} else if (m_replace && sampleCount () < m_sampler.n) {
+		return rng_below (m_sampler.key, RNG_STREAM_SAMPLE, s,
+				  m_sampler.n);
+	} else {
+		return rng_perm (&m_sampler, s);
+	}
+}
+
+/**
+  * Scales the accumulated weights by the number of instances processed.
+  */
+void scaleWeights (int totalInstances)
+{
+	int i;
+
+	// now scale weights by 1/m_numInstances (nominal class) or
+	// calculate weights numeric class
+	for (i = 0; i < m_numAttribs; i++) {
+		if (i != m_classIndex) {
+			m_finalWeights[i] *= (1.0 / (double) totalInstances);
+		}
+	}
+}
+
+/**
+  * One convergence check, on every rank: the top m_convergeK attributes of
+  * the weights so far, compared with those at the previous check.
+  *
+  * @return whether the top attributes have now been stable long enough
+  */
+static boolean converged ()
+{
+	int i, a, n, k;
+	int *top, *order;
+	double *sum;
+
+	sum = (double *) malloc_dbg (59, sizeof (double) * m_numAttribs);
+#ifdef NO_MPI
+	memcpy (sum, m_weights, sizeof (double) * m_numAttribs);
+#else
+	MPI_Allreduce (m_weights, sum, m_numAttribs, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+#endif
+
+	// rank only the attributes in use
+	top = (int *) malloc_dbg (60, sizeof (int) * m_numUsed);
+	for (i = n = 0; i < m_numUsed; i++) {
+		a = m_attributeRank[i];
+		if (a != m_classIndex) {
+			sum[n] = sum[a];
+			top[n++] = a;
+		}
+	}
+	k = (m_convergeK < n) ? m_convergeK : n;
+	order = (int *) malloc_dbg (61, sizeof (int) * m_numUsed);
+	index_sort (order, sum, n);
+	for (i = 0; i < k; i++) {
+		order[i] = top[order[i]];
+	}
+	free (top);
+	top = order;
+
+	if (m_lastTop != null && topk_overlap (m_lastTop, top, k) == k) {
+		m_stableChecks++;
+	} else {
+		m_stableChecks = 0;
+	}
+
+	free (m_lastTop);
+	m_lastTop = top;
+	free (sum);
+
+	return m_stableChecks >= m_patience;
+}
+
+/**
+  * Initializes a ReliefF attribute evaluator. 
+  *
+  * @param data set of instances serving as training data 
+  * @throws Exception if the evaluator has not been 
+  * generated successfully
+  */
+void buildEvaluator (arff_info_t * data, double *weights)
+{
+
+	int i, z, b, end, totalInstances;
+	int num_nodes, my_rank;
+	int *classCounts = null;
+	boolean summed = false;
+	size_t numSums = 0;
+	int64_t *fixed = null;
+	double *sums = null;
+	double *byRank;
+	double t0, t1;
+	neighbour_t *lists = null;
+	dist_cache_t *cache = null;
+#ifdef PRINT_STATUS
+	char buf[100];
+#endif
+
+#ifdef NO_MPI
+	t0 = metrics_now ();
+	num_nodes = 1;
+	my_rank = 0;
+#else
+	t0 = MPI_Wtime ();
+	MPI_Comm_size (MPI_COMM_WORLD, &num_nodes);
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	initEvaluator (data, weights);
+	byRank = (m_weightByDistance) ? m_weightsByRank : null;
+	m_scanDistances = m_scanAbandoned = m_scanBytes = 0;
+
+#ifndef NO_MPI
+	// each rank accumulates its own share, reduced into weights below
+	m_weights = (double *) malloc_dbg (2, sizeof (double) * m_numAttribs);
+	memset (m_weights, 0, sizeof (double) * m_numAttribs);
+#endif
+
+	// with a distance cache, neighbours come from its rows (the G
+	// algorithm changes the distances as it goes, so it cannot use one)
+	if (m_version == 0) {
+		cache = distanceCache (my_rank, num_nodes, true);
+	}
+	if (cache != null) {
+		m_rowLength = m_numClasses * m_Knn;
+		classCounts = (int *) malloc_dbg (95,
+						  sizeof (int) * m_numClasses);
+		lists = (neighbour_t *) malloc_dbg (96,
+						    sizeof (neighbour_t) *
+						    m_rowLength);
+		memset (classCounts, 0, sizeof (int) * m_numClasses);
+		for (i = 0; i < m_numInstances; i++) {
+			classCounts[m_instances[i]->data[m_classIndex].ival]++;
+		}
+	} else if (m_version == 0 && packCodes ()) {
+		// all nominal: integer distances, fixed-point weight sums
+		m_rowLength = m_numClasses * m_Knn;
+		numSums = (size_t) m_numClasses * m_numClasses * m_numAttribs;
+		lists = (neighbour_t *) malloc_dbg (114,
+						    sizeof (neighbour_t) *
+						    m_rowLength);
+		fixed = (int64_t *) malloc_dbg (115, sizeof (int64_t) *
+						m_numClasses * m_numClasses *
+						m_numCoded);
+		sums = (double *) malloc_dbg (116, sizeof (double) * numSums);
+		memset (sums, 0, sizeof (double) * numSums);
+		memset (fixed, 0, sizeof (int64_t) * m_numClasses *
+			m_numClasses * m_numCoded);
+	}
+
+	// deduplicated or approximate, the queries go into raw weight sums
+	if (m_version == 0 && m_convergeK == 0 && cache == null
+	    && (m_dedup || m_lshTables > 0)) {
+		summed = true;
+		if (m_dedup) {
+			groupRows ();
+		}
+		if (fixed == null) {
+			m_rowLength = m_numClasses * m_Knn;
+			numSums = (size_t) m_numClasses * m_numClasses *
+				m_numAttribs;
+			lists = (neighbour_t *) malloc_dbg (124,
+							    sizeof
+							    (neighbour_t) *
+							    m_rowLength);
+			sums = (double *) malloc_dbg (125,
+						      sizeof (double) *
+						      numSums);
+			memset (sums, 0, sizeof (double) * numSums);
+		}
+	}
+
+	// exact neighbours from metric trees, for the queries below (the G
+	// algorithm changes the distances as it goes, so it cannot use them)
+	if (m_useTrees && m_version == 0 && cache == null && !summed) {
+		buildTrees ();
+		if (lists == null) {
+			m_rowLength = m_numClasses * m_Knn;
+			lists = (neighbour_t *) malloc_dbg (144,
+							    sizeof
+							    (neighbour_t) *
+							    m_rowLength);
+		}
+	}
+
+	initSampler (m_numInstances);
+	totalInstances = sampleCount ();
+	m_stableChecks = 0;
+	m_lastTop = null;
+
+	if (m_groupOf != null) {
+		queryGroups (totalInstances, my_rank, num_nodes, lists, fixed,
+			     sums);
+	} else if (summed) {
+		queryApproximate (totalInstances, my_rank, num_nodes, lists,
+				  fixed, sums);
+	}
+
+	// process each instance, updating attribute weights; in convergence
+	// mode, a check's worth at a time
+	for (b = 0; b < totalInstances && !summed; b = end) {
+		end = totalInstances;
+		if (m_convergeK > 0 && b + m_checkEvery < totalInstances) {
+			end = b + m_checkEvery;
+		}
+		trace_begin (SPAN_BATCH);
+
+		for (i = b; i < end; i += num_nodes) {
+#ifdef PRINT_STATUS
+			sprintf (buf, "%05i:%05i", i, totalInstances);
+			printf ("%s\n", buf);
+			fflush (stdout);
+#endif
+
+			clearKHitMiss ();
+
+			if (i + my_rank < end) {
+				z = sampleInstance (i + my_rank);
+
+				metrics_begin (PHASE_SEARCH);
+				if (fixed != null) {
+					if (m_trees != null) {
+						treeSearch (z, lists);
+					} else {
+						fixedSearch (z, lists);
+					}
+					metrics_end (PHASE_SEARCH);
+					metrics_begin (PHASE_UPDATE);
+					if (m_rescore) {
+						rescoreLists (z, lists);
+						accumulateQuery (z, lists,
+								 m_Knn,
+								 byRank, sums,
+								 1.0);
+					} else {
+						fixedAccumulate (z, lists, 1,
+								 fixed);
+					}
+				} else if (cache != null) {
+					karrayFromCache (cache, z,
+							 classCounts, lists);
+					metrics_end (PHASE_SEARCH);
+					metrics_begin (PHASE_UPDATE);
+					updateWeightsDiscreteClass (z);
+				} else if (m_trees != null) {
+					treeSearch (z, lists);
+					karrayFromLists (lists);
+					metrics_end (PHASE_SEARCH);
+					metrics_begin (PHASE_UPDATE);
+					updateWeightsDiscreteClass (z);
+				} else {
+					findKHitMiss (z);
+					metrics_end (PHASE_SEARCH);
+					metrics_begin (PHASE_UPDATE);
+					updateWeightsDiscreteClass (z);
+				}
+				metrics_end (PHASE_UPDATE);
+			}
+
+			if (m_version == 1) {
+#ifndef NO_MPI
+				metrics_begin (PHASE_REDUCE);
+				MPI_Allreduce (m_weights, m_finalWeights,
+					       m_numAttribs, MPI_DOUBLE,
+					       MPI_SUM, MPI_COMM_WORLD);
+				metrics_end (PHASE_REDUCE);
+				if (my_rank == 0) {
+					memcpy (m_weights, m_finalWeights,
+						m_numAttribs *
+						sizeof (double));
+				} else {
+					memset (m_weights, 0,
+						m_numAttribs *
+						sizeof (double));
+				}
+#endif
+				index_sort (m_attributeRank, m_finalWeights,
+					    m_numAttribs);
+				m_numExcludedAttributes++;
+			}
+		}
+
+		trace_end (SPAN_BATCH);
+
+		if (m_convergeK > 0 && end < totalInstances) {
+			if (fixed != null) {
+				if (!m_rescore) {
+					fixedToSums (fixed, sums);
+				}
+				combineSums (sums, m_weights);
+			}
+			if (converged ()) {
+				totalInstances = end;
+			}
+		}
+	}
+	free (m_lastTop);
+	m_instancesUsed = totalInstances;
+	if (m_trees != null) {
+		releaseTrees (totalInstances);
+	}
+	metrics_count (COUNT_DISTANCES, m_scanDistances);
+	metrics_count (COUNT_ABANDONED, m_scanAbandoned);
+	metrics_count (COUNT_BYTES, m_scanBytes);
+
+	metrics_begin (PHASE_REDUCE);
+	if (fixed != null && !m_rescore) {
+#ifndef NO_MPI
+		MPI_Reduce ((my_rank == 0) ? MPI_IN_PLACE : fixed, fixed,
+			    m_numClasses * m_numClasses * m_numCoded,
+			    MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+		fixedToSums (fixed, sums);
+		sumsToWeights (sums, totalInstances);
+	} else if (sums != null) {
+#ifndef NO_MPI
+		MPI_Reduce ((my_rank == 0) ? MPI_IN_PLACE : sums, sums,
+			    numSums, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+		sumsToWeights (sums, totalInstances);
+	} else {
+#ifndef NO_MPI
+		if (m_version != 1) {
+			MPI_Reduce (m_weights, m_finalWeights, m_numAttribs,
+				    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+		}
+#endif
+		scaleWeights (totalInstances);
+	}
+	metrics_end (PHASE_REDUCE);
+#ifndef NO_MPI
+	free (m_weights);
+#endif
+
+	dcache_release (cache);
+	free (classCounts);
+	free (lists);
+	if (fixed != null) {
+		releaseCodes ();
+	}
+	free (fixed);
+	free (sums);
+	if (m_groupOf != null) {
+		releaseGroups ();
+	}
+	if (m_columnOf != null) {
+		fanOutColumns ();
+	}
+
+	releaseEvaluator ();
+
+#ifdef NO_MPI
+	t1 = metrics_now ();
+#else
+	t1 = MPI_Wtime ();
+#endif
+
+	m_totalTime = t1 - t0;
+}
+
+/**
+  * Attribute-partitioned ReliefF, for data too wide for one node.
+  *
+  * Each rank holds every instance but only its own slice of the attributes
+  * (see read_arff_filtered).  Queries are taken a batch at a time: every rank
+  * computes the distances over its slice from each query in the batch to all
+  * instances, an allreduce sums the slices into full distances, and every
+  * rank then picks the same neighbours and updates the weights of its own
+  * attributes.  No final reduction is needed; weights holds the weights of
+  * the local attributes.
+  *
+  * @param data the local slice of the training data
+  * @param weights the final weights of the local attributes
+  * @param batch the number of queries per allreduce
+  */
+void buildEvaluatorPartitioned (arff_info_t * data, double *weights,
+				int batch)
+{
+#ifdef NO_MPI
+	buildEvaluator (data, weights);
+#else
+	int i, j, q, nq, totalInstances;
+	int *queries;
+	double *dist;
+	double t0, t1;
+
+	t0 = MPI_Wtime ();
+
+	initEvaluator (data, weights);
+
+	initSampler (m_numInstances);
+	totalInstances = sampleCount ();
+
+	queries = (int *) malloc_dbg (44, sizeof (int) * batch);
+	dist = (double *) malloc_dbg (45,
+				      sizeof (double) * batch *
+				      m_numInstances);
+
+	for (i = 0; i < totalInstances; i += batch) {
+		nq = totalInstances - i;
+		if (nq > batch)
+			nq = batch;
+
+		// every rank draws the same queries
+		for (q = 0; q < nq; q++) {
+			queries[q] = sampleInstance (i + q);
+		}
+
+		// partial distances over the local attributes
+		for (q = 0; q < nq; q++) {
+			instance_t *thisInst = m_instances[queries[q]];
+			for (j = 0; j < m_numInstances; j++) {
+				dist[q * m_numInstances + j] =
+					distance (m_instances[j], thisInst);
+			}
+		}
+
+		MPI_Allreduce (MPI_IN_PLACE, dist, nq * m_numInstances,
+			       MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+		for (q = 0; q < nq; q++) {
+			clearKHitMiss ();
+
+			for (j = 0; j < m_numInstances; j++) {
+				if (j != queries[q]) {
+					insertKHitMiss (j,
+							dist[q *
+							     m_numInstances +
+							     j]);
+				}
+			}
+
+			updateWeightsDiscreteClass (queries[q]);
+		}
+	}
+
+	free (queries);
+	free (dist);
+
+	m_instancesUsed = totalInstances;
+	scaleWeights (totalInstances);
+
+	releaseEvaluator ();
+
+	t1 = MPI_Wtime ();
+
+	m_totalTime = t1 - t0;
+#endif
+}
+
+/**
+  * Inserts a neighbour into a list of m_Knn, kept sorted by distance and
+  * then index, with empty slots (index -1) last.  The list ends up holding
+  * the same neighbours insertKHitMiss would pick scanning by index.
+  *
+  * @return whether the neighbour made the list
+  */
+static boolean insertSorted (neighbour_t * list, double dist, int index)
+{
+	int j = m_Knn - 1;
+
+	if (list[j].index >= 0 && (dist > list[j].dist
+				   || (dist == list[j].dist
+				       && index > list[j].index)))
+		return false;
+
+	for (; j > 0; j--) {
+		if (list[j - 1].index >= 0 && (dist > list[j - 1].dist
+					       || (dist == list[j - 1].dist
+						   && index >
+						   list[j - 1].index)))
+			break;
+		list[j] = list[j - 1];
+	}
+	list[j].dist = dist;
+	list[j].index = index;
+	return true;
+}
+
+#ifndef NO_MPI
+/**
+  * MPI reduction merging rows of per-class neighbour lists.
+  */
+static void mergeNeighbours (void *in, void *inout, int *len,
+			     MPI_Datatype * type)
+{
+	neighbour_t *a = (neighbour_t *) in;
+	neighbour_t *b = (neighbour_t *) inout;
+	int i, j;
+
+	for (i = 0; i < *len * m_numClasses; i++) {
+		for (j = 0; j < m_Knn && a[j].index >= 0; j++) {
+			insertSorted (b, a[j].dist, a[j].index);
+		}
+		a += m_Knn;
+		b += m_Knn;
+	}
+}
+
+/**
+  * Merges the neighbour tables (rows of m_rowLength) of all ranks in comm,
+  * leaving every rank with the nearest neighbours over all of them.
+  */
+static void mergeTables (neighbour_t * table, int rows, MPI_Comm comm)
+{
+	MPI_Datatype rowType;
+	MPI_Op mergeOp;
+
+	MPI_Type_contiguous (sizeof (neighbour_t) * m_rowLength, MPI_BYTE,
+			     &rowType);
+	MPI_Type_commit (&rowType);
+	MPI_Op_create (mergeNeighbours, 1, &mergeOp);
+	MPI_Allreduce (MPI_IN_PLACE, table, rows, rowType, mergeOp, comm);
+	MPI_Op_free (&mergeOp);
+	MPI_Type_free (&rowType);
+}
+#endif
+
+/**
+  * ReliefF with the distance matrix split into 2D blocks.
+  *
+  * The ranks form a rows x cols grid.  Rank (r, c) holds only its row panel
+  * (instances i with i % rows == r, the queries) and its column panel
+  * (i % cols == c, the candidates) and computes only that block of the
+  * distance matrix, tile by tile, keeping per-class nearest hits and misses
+  * for each of its queries.  When every instance is a query, each pair on a
+  * diagonal block is computed once and counted for both instances.  The
+  * lists are merged along each grid row with a custom MPI reduction, after
+  * which rank (r, c) applies the weight updates for the neighbours in its
+  * own column panel; a final reduction sums the weights on rank 0.
+  *
+  * @param data the local panels, loaded with LOAD_BLOCK
+  * @param weights the final attribute weights
+  * @param rows the number of grid rows (see block_grid)
+  * @param cols the number of grid columns
+  */
+void buildEvaluatorBlocked (arff_info_t * data, double *weights, int rows,
+			    int cols)
+{
+#ifdef NO_MPI
+	buildEvaluator (data, weights);
+#else
+	int i, j, q, k, qt, kt, nq, nk, cl, total, sampled;
+	int my_rank, r, c, diagonal;
+	int *queries, *cands, *local, *drawn;
+	neighbour_t *table, *list;
+	MPI_Comm rowComm;
+	double d, t0, t1;
+
+	t0 = MPI_Wtime ();
+
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+	r = my_rank / cols;
+	c = my_rank % cols;
+	diagonal = (rows == cols) && (r == c);
+	MPI_Comm_split (MPI_COMM_WORLD, r, c, &rowComm);
+
+	initEvaluator (data, weights);
+	m_weights = (double *) malloc_dbg (2, sizeof (double) * m_numAttribs);
+	memset (m_weights, 0, sizeof (double) * m_numAttribs);
+
+	// split the local instances into queries and candidates
+	queries = (int *) malloc_dbg (54, sizeof (int) * m_numInstances);
+	cands = (int *) malloc_dbg (55, sizeof (int) * m_numInstances);
+	for (i = nq = nk = 0; i < m_numInstances; i++) {
+		if (data->inst_map[i] % rows == r) {
+			queries[nq++] = i;
+		}
+		if (data->inst_map[i] % cols == c) {
+			cands[nk++] = i;
+		}
+	}
+
+	// class priors and numeric ranges are over all instances, not just
+	// the local panels; each row panel is counted once, by column 0
+	memset (m_classProbs, 0, sizeof (double) * m_numClasses);
+	if (c == 0) {
+		for (q = 0; q < nq; q++) {
+			m_classProbs[m_instances[queries[q]]->
+				     data[m_classIndex].ival]++;
+		}
+	}
+	MPI_Allreduce (MPI_IN_PLACE, m_classProbs, m_numClasses, MPI_DOUBLE,
+		       MPI_SUM, MPI_COMM_WORLD);
+	for (i = 0, total = 0; i < m_numClasses; i++) {
+		total += (int) m_classProbs[i];
+	}
+	for (i = 0; i < m_numClasses; i++) {
+		m_classProbs[i] /= total;
+	}
+
+	// with a sample, only the drawn instances of the row panel are queries,
+	// each processed as often as it was drawn
+	initSampler (total);
+	sampled = sampleCount ();
+	drawn = (int *) malloc_dbg (58, sizeof (int) * total);
+	if (sampled == total) {
+		for (i = 0; i < total; i++) {
+			drawn[i] = 1;
+		}
+	} else {
+		memset (drawn, 0, sizeof (int) * total);
+		for (i = 0; i < sampled; i++) {
+			drawn[sampleInstance (i)]++;
+		}
+		for (q = j = 0; q < nq; q++) {
+			if (drawn[data->inst_map[queries[q]]] > 0) {
+				queries[j++] = queries[q];
+			}
+		}
+		nq = j;
+		diagonal = 0;
+	}
+
+	for (i = 0; i < m_numAttribs; i++) {
+		if (m_minArray[i] == DBL_MAX) {
+			m_maxArray[i] = -DBL_MAX;
+		}
+	}
+	MPI_Allreduce (MPI_IN_PLACE, m_minArray, m_numAttribs, MPI_DOUBLE,
+		       MPI_MIN, MPI_COMM_WORLD);
+	MPI_Allreduce (MPI_IN_PLACE, m_maxArray, m_numAttribs, MPI_DOUBLE,
+		       MPI_MAX, MPI_COMM_WORLD);
+	for (i = 0; i < m_numAttribs; i++) {
+		if (m_minArray[i] == DBL_MAX) {
+			m_maxArray[i] = DBL_MAX;
+		}
+	}
+
+	// per query, per class, the m_Knn nearest so far
+	m_rowLength = m_numClasses * m_Knn;
+	table = (neighbour_t *) malloc_dbg (56,
+					    sizeof (neighbour_t) * nq *
+					    m_rowLength);
+	for (i = 0; i < nq * m_rowLength; i++) {
+		table[i].dist = DBL_MAX;
+		table[i].index = -1;
+	}
+
+	for (qt = 0; qt < nq; qt += BLOCK_TILE) {
+		for (kt = diagonal ? qt : 0; kt < nk; kt += BLOCK_TILE) {
+			for (q = qt; q < qt + BLOCK_TILE && q < nq; q++) {
+				instance_t *thisInst = m_instances[queries[q]];
+
+				for (k = kt; k < kt + BLOCK_TILE && k < nk;
+				     k++) {
+					instance_t *cmpInst =
+						m_instances[cands[k]];
+
+					if (diagonal ? (k <= q)
+					    : (cands[k] == queries[q])) {
+						continue;
+					}
+
+					d = distance (cmpInst, thisInst);
+
+					cl = cmpInst->data[m_classIndex].ival;
+					insertSorted (table +
+						      q * m_rowLength +
+						      cl * m_Knn, d,
+						      data->inst_map[cands
+								     [k]]);
+
+					if (diagonal) {
+						// cands[k] is query k, too
+						cl = thisInst->
+							data[m_classIndex].
+							ival;
+						insertSorted (table +
+							      k *
+							      m_rowLength +
+							      cl * m_Knn, d,
+							      data->
+							      inst_map[queries
+								       [q]]);
+					}
+				}
+			}
+		}
+	}
+
+	mergeTables (table, nq, rowComm);
+
+	// global instance index -> local index of the column panel, or -1
+	j = (m_numInstances > 0) ? data->inst_map[m_numInstances - 1] : 0;
+	MPI_Allreduce (&j, &i, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+	local = (int *) malloc_dbg (57, sizeof (int) * (i + 1));
+	for (j = 0; j <= i; j++) {
+		local[j] = -1;
+	}
+	for (k = 0; k < nk; k++) {
+		local[data->inst_map[cands[k]]] = cands[k];
+	}
+
+	for (q = 0; q < nq; q++) {
+		clearKHitMiss ();
+
+		for (cl = 0; cl < m_numClasses; cl++) {
+			list = table + q * m_rowLength + cl * m_Knn;
+			for (j = 0; j < m_Knn && list[j].index >= 0; j++) {
+				m_karray[cl][j][0] = list[j].dist;
+				m_karray[cl][j][1] = local[list[j].index];
+				m_karray[cl][j][2] = list[j].index;
+			}
+			m_stored[cl] = j;
+		}
+
+		for (j = 0; j < drawn[data->inst_map[queries[q]]]; j++) {
+			updateWeightsDiscreteClass (queries[q]);
+		}
+	}
+
+	MPI_Reduce (m_weights, m_finalWeights, m_numAttribs, MPI_DOUBLE,
+		    MPI_SUM, 0, MPI_COMM_WORLD);
+	free (m_weights);
+
+	free (queries);
+	free (cands);
+	free (local);
+	free (drawn);
+	free (table);
+	MPI_Comm_free (&rowComm);
+
+	m_instancesUsed = sampled;
+	scaleWeights (sampled);
+
+	releaseEvaluator ();
+
+	t1 = MPI_Wtime ();
+
+	m_totalTime = t1 - t0;
+#endif
+}
+
+/**
+  * The weight of each neighbour in a sorted list, as
+  * updateWeightsDiscreteClass gives them: ranked farthest first, equal
+  * distances by index.
+  *
+  * @param list the neighbour list, nearest first
+  * @param k the number of nearest to use
+  * @param byRank the weight for each rank (see m_weightsByRank), or null
+  * to weight the neighbours equally
+  * @param w the weight of each of them
+  * @return the number of neighbours in the list, at most k
+  */
+static int neighbourWeights (neighbour_t * list, int k, double *byRank,
+			     double *w)
+{
+	int j, e, lo, hi, n;
+	double norm;
+
+	for (n = 0; n < k && list[n].index >= 0; n++);
+
+	for (j = 0, norm = 0; byRank != null && j < n; j++) {
+		norm += byRank[j];
+	}
+
+	// take runs of equal distance from the end, each run in index order
+	for (j = 0, hi = n; hi > 0; hi = lo) {
+		for (lo = hi - 1;
+		     lo > 0 && list[lo - 1].dist == list[hi - 1].dist; lo--);
+
+		for (e = lo; e < hi; e++, j++) {
+			w[e] = (byRank != null) ? byRank[j] / norm : 1.0 / n;
+		}
+	}
+	return n;
+}
+
+/**
+  * Adds sign times the raw weight contributions of a query's neighbour
+  * lists to sums (see relief_state_t), with the query's class taken from
+  * m_labels if set.  The neighbours are weighted as in
+  * updateWeightsDiscreteClass, the farthest ranked first and equal
+  * distances by index, but the sign and the class prior factors are left
+  * to sumsToWeights.
+  *
+  * @param q the index of the query instance
+  * @param lists its per-class neighbour lists, m_Knn long
+  * @param k the number of nearest of each list to use, at most m_Knn
+  * @param byRank the weight for each rank (see m_weightsByRank), or null
+  * to weight the neighbours equally
+  * @param sums the raw weight sums
+  * @param sign 1 to add the contributions, -1 to take them back out, or
+  * another factor, such as the times the query was drawn
+  */
+static void accumulateQuery (int q, neighbour_t * lists, int k,
+			     double *byRank, double *sums, double sign)
+{
+	int a, i, e, n, cq, cn;
+	double *row;
+	neighbour_t *list;
+	instance_t *cmp, *inst = m_instances[q];
+
+	cq = (m_labels != null) ? m_labels[q] : inst->data[m_classIndex].ival;
+
+	for (cn = 0; cn < m_numClasses; cn++) {
+		list = lists + cn * m_Knn;
+		n = neighbourWeights (list, k, byRank, tempWeights);
+
+		row = sums + (cq * m_numClasses + cn) * m_numAttribs;
+		for (e = 0; e < n; e++) {
+			cmp = m_instances[list[e].index];
+
+			for (i = 0; i < m_numUsed; i++) {
+				a = m_attributeRank[i];
+				if (a != m_classIndex) {
+					row[a] += sign * tempWeights[e] *
+						difference (a, inst->data,
+							    cmp->data);
+				}
+			}
+		}
+	}
+}
+
+/**
+  * Combines raw weight sums into weights: hits count against an attribute,
+  * misses for it, weighted by their class priors when there are more than
+  * two classes.
+  *
+  * @param sums the raw weight sums
+  * @param weights the weights, unscaled
+  */
+static void combineSums (double *sums, double *weights)
+{
+	int a, cq, cn;
+	double factor, *row;
+
+	memset (weights, 0, sizeof (double) * m_numAttribs);
+
+	for (cq = 0; cq < m_numClasses; cq++) {
+		for (cn = 0; cn < m_numClasses; cn++) {
+			if (cq == cn) {
+				factor = -1.0;
+			} else if (m_numClasses > 2) {
+				factor = m_classProbs[cn] /
+					(1.0 - m_classProbs[cq]);
+			} else {
+				factor = 1.0;
+			}
+
+			row = sums + (cq * m_numClasses + cn) * m_numAttribs;
+			for (a = 0; a < m_numAttribs; a++) {
+				weights[a] += factor * row[a];
+			}
+		}
+	}
+}
+
+/**
+  * Turns raw weight sums into the final weights, all over the number of
+  * instances (see combineSums).
+  *
+  * @param sums the raw weight sums
+  * @param total the number of instances
+  */
+static void sumsToWeights (double *sums, int total)
+{
+	combineSums (sums, m_finalWeights);
+	scaleWeights (total);
+}
+
+/**
+  * Sets up the integer kernel, for when every attribute in use is nominal
+  * with at most 256 values: distances are then mismatch counts (or sums of
+  * value differences), and each neighbour's contribution is a small
+  * integer times its weight.  The values are packed a byte per attribute
+  * in use, so distances take a tight loop over bytes.
+  *
+  * @return whether the kernel applies, and the codes fit in memory on every
+  * rank; if not, nothing is set up
+  */
+static boolean packCodes ()
+{
+	int i, c, a, v, pass;
+	boolean ok;
+
+	m_sparseUsed = false;
+	for (i = m_numCoded = m_numQuant = 0; i < m_numUsed; i++) {
+		a = m_attributeRank[i];
+		if (a == m_classIndex) {
+			continue;
+		}
+		if (m_quantize && m_attributes[a]->type == ATTR_NUMERIC) {
+			m_numQuant++;
+		} else if (m_attributes[a]->type != ATTR_NOMINAL
+			   || m_attributes[a]->nom_info->num_classes > 256) {
+			m_numQuant = 0;
+			return false;
+		}
+		m_numCoded++;
+	}
+	m_codeScale = (m_numQuant > 0) ? QUANT_BINS : 1;
+
+	m_coded = (int *) malloc_dbg (111, sizeof (int) * m_numCoded);
+	m_codes = (unsigned char *) malloc_dbg (112, (size_t) m_numInstances *
+						m_numCoded);
+	m_codeLabels = (int *) malloc_dbg (113, sizeof (int) * m_numInstances);
+	if (m_columnCount != null) {
+		m_codeCounts = (unsigned int *) malloc_dbg (126,
+							    sizeof (unsigned
+								    int) *
+							    m_numCoded);
+	}
+	ok = m_numCoded == 0 || (m_coded != null && m_codes != null
+				 && (m_columnCount == null
+				     || m_codeCounts != null));
+	if (!everywhere (ok && m_codeLabels != null)) {
+		releaseCodes ();
+		m_numQuant = 0;
+		return false;
+	}
+
+	// the quantized columns first, then the nominal ones
+	for (pass = c = 0; pass < 2; pass++) {
+		for (i = 0; i < m_numUsed; i++) {
+			a = m_attributeRank[i];
+			if (a == m_classIndex
+			    || (m_attributes[a]->type == ATTR_NUMERIC) !=
+			    (pass == 0)) {
+				continue;
+			}
+			if (m_codeCounts != null) {
+				m_codeCounts[c] = m_columnCount[a];
+			}
+			m_coded[c++] = a;
+		}
+	}
+	for (i = 0; i < m_numInstances; i++) {
+		m_codeLabels[i] = m_instances[i]->data[m_classIndex].ival;
+		for (c = 0; c < m_numCoded; c++) {
+			a = m_coded[c];
+			if (c < m_numQuant) {
+				v = (int) floor (norm (m_instances[i]->
+						       data[a].fval,
+						       a) * QUANT_BINS + 0.5);
+				v = (v < 0) ? 0 : (v > QUANT_BINS) ?
+					QUANT_BINS : v;
+			} else {
+				v = m_instances[i]->data[a].ival;
+			}
+			if (v < 0 || v > 255) {
+				releaseCodes ();
+				m_numQuant = 0;
+				return false;
+			}
+			m_codes[(size_t) i * m_numCoded + c] = v;
+		}
+	}
+	packSparse ();
+	return true;
+}
+
+/** Frees what packCodes set up */
+static void releaseCodes ()
+{
+	releaseSparse ();
+	free (m_coded);
+	free (m_codes);
+	free (m_codeLabels);
+	free (m_codeCounts);
+	m_codeCounts = null;
+	m_coded = null;
+	m_codes = null;
+	m_codeLabels = null;
+}
+
+/**
+  * The sum of the absolute differences of n bytes, sixteen at a time (with
+  * psadbw) where there is SSE2.
+  */
+static unsigned int sadCodes (unsigned char *x, unsigned char *y, int n)
+{
+	unsigned int d = 0;
+	int c = 0;
+#ifdef __SSE2__
+	__m128i sum = _mm_setzero_si128 ();
+
+	for (; c + 16 <= n; c += 16) {
+		sum = _mm_add_epi64 (sum,
+				     _mm_sad_epu8 (_mm_loadu_si128
+						   ((__m128i *) (x + c)),
+						   _mm_loadu_si128
+						   ((__m128i *) (y + c))));
+	}
+	d = _mm_cvtsi128_si32 (sum) +
+		_mm_cvtsi128_si32 (_mm_unpackhi_epi64 (sum, sum));
+#endif
+	for (; c < n; c++) {
+		d += abs (x[c] - y[c]);
+	}
+	return d;
+}
+
+/**
+  * The number of n bytes that differ, sixteen at a time (counting the
+  * equal ones with pcmpeqb and psadbw) where there is SSE2.
+  */
+static unsigned int mismatchCodes (unsigned char *x, unsigned char *y, int n)
+{
+	unsigned int d = 0;
+	int c = 0;
+#ifdef __SSE2__
+	__m128i same = _mm_setzero_si128 (), one = _mm_set1_epi8 (1);
+
+	for (; c + 16 <= n; c += 16) {
+		same = _mm_add_epi64 (same,
+				      _mm_sad_epu8 (_mm_and_si128
+						    (_mm_cmpeq_epi8
+						     (_mm_loadu_si128
+						      ((__m128i *) (x + c)),
+						      _mm_loadu_si128
+						      ((__m128i *) (y + c))),
+						     one),
+						    _mm_setzero_si128 ()));
+	}
+	d = c - (_mm_cvtsi128_si32 (same) +
+		 _mm_cvtsi128_si32 (_mm_unpackhi_epi64 (same, same)));
+#endif
+	for (; c < n; c++) {
+		d += (x[c] != y[c]);
+	}
+	return d;
+}
+
+/** The difference between two packed values of column c */
+static unsigned int differenceCodes (int c, int v, int w)
+{
+	unsigned int d;
+
+	if (c < m_numQuant) {
+		d = abs (v - w);
+	} else {
+		d = m_codeScale * ((m_difference == 0) ? (v != w)
+				   : abs (v - w));
+	}
+	return (m_codeCounts != null) ? m_codeCounts[c] * d : d;
+}
+
+/**
+  * The integer distance between two packed instances over columns from
+  * up to, not including, to, unweighted.
+  */
+static unsigned int spanCodes (unsigned char *x, unsigned char *y,
+			       int from, int to)
+{
+	unsigned int d = 0, n = 0;
+	int q = (to < m_numQuant) ? to : m_numQuant;
+
+	if (from < q) {
+		d = sadCodes (x + from, y + from, q - from);
+		from = q;
+	}
+	if (from < to) {
+		n = (m_difference == 0) ? mismatchCodes (x + from, y + from,
+							 to - from)
+			: sadCodes (x + from, y + from, to - from);
+	}
+	return d + m_codeScale * n;
+}
+
+/** The integer distance between two packed instances */
+static unsigned int distanceCodes (unsigned char *x, unsigned char *y)
+{
+	unsigned int d = 0;
+	int c;
+
+	if (m_codeCounts != null) {
+		for (c = 0; c < m_numCoded; c++) {
+			d += differenceCodes (c, x[c], y[c]);
+		}
+		return d;
+	}
+	return spanCodes (x, y, 0, m_numCoded);
+}
+
+/**
+  * Sets up the sparse form of the packed values, if few enough of them
+  * differ from their column's most common value (see m_sparseBelow): each
+  * instance keeps only its deviations, by column, and the sum of their
+  * differences from the modes.  The values stay dense if the sparse form
+  * does not fit in memory on every rank.
+  */
+static void packSparse ()
+{
+	int i, c, v, *histogram;
+	size_t n, deviations = 0;
+	unsigned char *x;
+
+	if (m_sparseBelow <= 0 || m_numCoded == 0) {
+		return;
+	}
+
+	// the mode of each column
+	m_codeModes = (unsigned char *) malloc_dbg (145, m_numCoded);
+	histogram = (int *) malloc_dbg (146, sizeof (int) * 256);
+	for (c = 0; c < m_numCoded; c++) {
+		memset (histogram, 0, sizeof (int) * 256);
+		for (i = 0; i < m_numInstances; i++) {
+			histogram[m_codes[(size_t) i * m_numCoded + c]]++;
+		}
+		for (v = 1, m_codeModes[c] = 0; v < 256; v++) {
+			if (histogram[v] > histogram[m_codeModes[c]]) {
+				m_codeModes[c] = v;
+			}
+		}
+		deviations += m_numInstances - histogram[m_codeModes[c]];
+	}
+	free (histogram);
+
+	if (deviations >= m_sparseBelow * m_numInstances * m_numCoded) {
+		free (m_codeModes);
+		m_codeModes = null;
+		return;
+	}
+
+	m_devStart = (size_t *) malloc_dbg (147, sizeof (size_t) *
+					    ((size_t) m_numInstances + 1));
+	m_devColumns = (int *) malloc_dbg (148, sizeof (int) * deviations);
+	m_devValues = (unsigned char *) malloc_dbg (149, deviations);
+	m_devSelf = (unsigned int *) malloc_dbg (150, sizeof (unsigned int) *
+						 m_numInstances);
+	if (!everywhere (m_devStart != null && m_devSelf != null
+			 && (deviations == 0 || (m_devColumns != null
+						 && m_devValues != null)))) {
+		m_sparseUsed = false;
+		releaseSparse ();
+		return;
+	}
+	m_sparseUsed = true;
+	for (i = 0, n = 0; i < m_numInstances; i++) {
+		x = m_codes + (size_t) i * m_numCoded;
+		m_devStart[i] = n;
+		m_devSelf[i] = 0;
+		for (c = 0; c < m_numCoded; c++) {
+			if (x[c] != m_codeModes[c]) {
+				m_devColumns[n] = c;
+				m_devValues[n++] = x[c];
+				m_devSelf[i] += differenceCodes (c, x[c],
+								 m_codeModes
+								 [c]);
+			}
+		}
+	}
+	m_devStart[m_numInstances] = n;
+}
+
+/** Frees what packSparse set up */
+static void releaseSparse ()
+{
+	if (m_codeModes == null) {
+		return;
+	}
+	free (m_codeModes);
+	free (m_devStart);
+	free (m_devColumns);
+	free (m_devValues);
+	free (m_devSelf);
+	m_codeModes = null;
+}
+
+/**
+  * The integer distance between two instances in sparse form.  Where only
+  * one deviates, the difference is its difference from the mode, which its
+  * sum of those already counts; merging the two lists corrects the columns
+  * where both deviate.
+  */
+static unsigned int distanceSparse (int a, int b)
+{
+	unsigned int d = m_devSelf[a] + m_devSelf[b];
+	size_t i = m_devStart[a], ie = m_devStart[a + 1];
+	size_t j = m_devStart[b], je = m_devStart[b + 1];
+	int c;
+
+	while (i < ie && j < je) {
+		if (m_devColumns[i] < m_devColumns[j]) {
+			i++;
+		} else if (m_devColumns[i] > m_devColumns[j]) {
+			j++;
+		} else {
+			c = m_devColumns[i];
+			d += differenceCodes (c, m_devValues[i], m_devValues[j])
+				- differenceCodes (c, m_devValues[i],
+						   m_codeModes[c])
+				- differenceCodes (c, m_devValues[j],
+						   m_codeModes[c]);
+			i++;
+			j++;
+		}
+	}
+	return d;
+}
+
+/** The integer distance between instances a and b, packed */
+static unsigned int codedDistance (int a, int b)
+{
+	if (m_codeModes != null) {
+		return distanceSparse (a, b);
+	}
+	return distanceCodes (m_codes + (size_t) a * m_numCoded,
+			      m_codes + (size_t) b * m_numCoded);
+}
+
+/**
+  * The integer distance between instances a and b, as codedDistance, if it
+  * is below bound; otherwise no less than bound, found by adding up
+  * CODE_TILE columns at a time and stopping once there.
+  */
+static unsigned int boundedDistance (int a, int b, unsigned int bound)
+{
+	unsigned char *x, *y;
+	unsigned int d = 0;
+	int c, end;
+
+	m_scanDistances++;
+	if (m_codeModes != null || m_codeCounts != null) {
+		return codedDistance (a, b);
+	}
+	x = m_codes + (size_t) a * m_numCoded;
+	y = m_codes + (size_t) b * m_numCoded;
+	for (c = 0; c < m_numCoded && d < bound; c = end) {
+		end = (m_numCoded - c > CODE_TILE) ? c + CODE_TILE : m_numCoded;
+		d += spanCodes (x, y, c, end);
+	}
+	m_scanBytes += c;
+	if (c < m_numCoded) {
+		m_scanAbandoned++;
+	}
+	return d;
+}
+
+/**
+  * A query's neighbours by integer distance, kept as in
+  * buildEvaluatorSweep.
+  *
+  * @param q the index of the query instance
+  * @param lists the per-class neighbour lists to fill
+  */
+static void fixedSearch (int q, neighbour_t * lists)
+{
+	int i, j, cl;
+	unsigned int d, bound;
+	neighbour_t *list;
+
+	for (i = 0; i < m_rowLength; i++) {
+		lists[i].dist = DBL_MAX;
+		lists[i].index = -1;
+	}
+
+	// a class at a time, in index order: once the class's list is full,
+	// a candidate has to come in below its last to make it
+	for (cl = 0; cl < m_numClasses; cl++) {
+		list = lists + cl * m_Knn;
+		bound = UINT_MAX;
+		for (j = m_classStart[cl]; j < m_classStart[cl + 1]; j++) {
+			i = m_classMembers[j];
+			if (i == q) {
+				continue;
+			}
+			d = boundedDistance (q, i, bound);
+			if (d < bound) {
+				insertSorted (list, d, i);
+				if (list[m_Knn - 1].index >= 0) {
+					bound = list[m_Knn - 1].dist;
+				}
+			}
+		}
+	}
+}
+
+/**
+  * Adds a query's neighbours' contributions to fixed-point raw weight sums,
+  * with the integer kernel.  Each neighbour's weight (see neighbourWeights)
+  * is rounded to a multiple of 1 / FIXED_ONE once; the sums themselves are
+  * exact, so they come out the same whatever the order of the queries, and
+  * whichever rank took them.
+  *
+  * @param q the index of the query instance
+  * @param lists its per-class neighbour lists
+  * @param times the times the query counts
+  * @param fixed the fixed-point raw weight sums, per query class,
+  * neighbour class and packed column
+  */
+static void fixedAccumulate (int q, neighbour_t * lists, int times,
+			     int64_t * fixed)
+{
+	int c, e, n, cn;
+	int64_t w, *row;
+	unsigned char *x = m_codes + (size_t) q * m_numCoded, *y;
+	double *byRank = (m_weightByDistance) ? m_weightsByRank : null;
+	neighbour_t *list;
+
+	for (cn = 0; cn < m_numClasses; cn++) {
+		list = lists + cn * m_Knn;
+		n = neighbourWeights (list, m_Knn, byRank, tempWeights);
+		row = fixed + (m_codeLabels[q] * m_numClasses + cn) *
+			m_numCoded;
+
+		for (e = 0; e < n; e++) {
+			w = llround (tempWeights[e] * FIXED_ONE) * times;
+			y = m_codes + (size_t) list[e].index * m_numCoded;
+			for (c = 0; c < m_numQuant; c++) {
+				row[c] += w * abs (x[c] - y[c]);
+			}
+			if (m_difference == 0) {
+				for (c = m_numQuant; c < m_numCoded; c++) {
+					row[c] += w * (x[c] != y[c]);
+				}
+			} else {
+				for (c = m_numQuant; c < m_numCoded; c++) {
+					row[c] += w * abs (x[c] - y[c]);
+				}
+			}
+		}
+	}
+}
+
+/** Fixed-point raw weight sums, by packed column, as raw weight sums */
+static void fixedToSums (int64_t * fixed, double *sums)
+{
+	int c, s;
+
+	memset (sums, 0, sizeof (double) * m_numClasses * m_numClasses *
+		m_numAttribs);
+	for (s = 0; s < m_numClasses * m_numClasses; s++) {
+		for (c = 0; c < m_numCoded; c++) {
+			sums[s * m_numAttribs + m_coded[c]] =
+				fixed[s * m_numCoded + c] / FIXED_ONE /
+				((c < m_numQuant) ? QUANT_BINS : 1);
+		}
+	}
+}
+
+/**
+  * Rescores quantized neighbour lists (see m_rescore) in place, ordering
+  * each class's neighbours by their full-precision distances.
+  */
+static void rescoreLists (int q, neighbour_t * lists)
+{
+	int j, e, cn;
+	neighbour_t *list, t;
+
+	if (m_numQuant == 0) {
+		return;
+	}
+	for (cn = 0; cn < m_numClasses; cn++) {
+		list = lists + cn * m_Knn;
+		for (e = 0; e < m_Knn && list[e].index >= 0; e++) {
+			t.index = list[e].index;
+			t.dist = distance (m_instances[q],
+					   m_instances[t.index]);
+			for (j = e; j > 0 && (list[j - 1].dist > t.dist
+					      || (list[j - 1].dist == t.dist
+						  && list[j - 1].index >
+						  t.index)); j--) {
+				list[j] = list[j - 1];
+			}
+			list[j] = t;
+		}
+	}
+}
+
+/** FNV-1a hash of attribute a's column */
+static uint64_t hashColumn (int a)
+{
+	unsigned char *p;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t j;
+	int i;
+
+	for (i = 0; i < m_numInstances; i++) {
+		p = (unsigned char *) &m_instances[i]->data[a];
+		for (j = 0; j < sizeof (data_t); j++) {
+			hash = (hash ^ p[j]) * 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
+
+/** Whether attributes a and b have the same type and column */
+static boolean sameColumn (int a, int b)
+{
+	int i;
+
+	if (m_attributes[a]->type != m_attributes[b]->type) {
+		return false;
+	}
+	for (i = 0; i < m_numInstances; i++) {
+		if (memcmp (&m_instances[i]->data[a], &m_instances[i]->data[b],
+			    sizeof (data_t)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+  * Collapses identical columns among the attributes in use (see
+  * m_columnOf), narrowing the view to the first of each.  Identical columns
+  * have identical differences everywhere, so scoring one, counted as many
+  * times in the distances, gives the weight of every one of them.  Columns
+  * are hashed into a table of twice their number, chaining those in a
+  * bucket.
+  */
+static void collapseColumns ()
+{
+	int i, a, h, r, n, size, *head, *chain;
+	uint64_t *hash;
+
+	for (size = 1; size < 2 * m_numUsed; size <<= 1);
+	head = (int *) malloc_dbg (127, sizeof (int) * size);
+	chain = (int *) malloc_dbg (128, sizeof (int) * m_numAttribs);
+	hash = (uint64_t *) malloc_dbg (129, sizeof (uint64_t) * m_numAttribs);
+	m_columnOf = (int *) malloc_dbg (130, sizeof (int) * m_numAttribs);
+	m_columnCount = (int *) malloc_dbg (131, sizeof (int) * m_numAttribs);
+	memset (head, -1, sizeof (int) * size);
+	memset (m_columnOf, -1, sizeof (int) * m_numAttribs);
+	memset (m_columnCount, 0, sizeof (int) * m_numAttribs);
+
+	for (i = n = 0; i < m_numUsed; i++) {
+		a = m_attributeRank[i];
+		if (a == m_classIndex) {
+			m_attributeRank[n++] = a;
+			continue;
+		}
+		hash[a] = hashColumn (a);
+		h = hash[a] & (size - 1);
+		for (r = head[h]; r >= 0 && (hash[r] != hash[a]
+					     || !sameColumn (r, a));
+		     r = chain[r]);
+		if (r < 0) {
+			r = a;
+			chain[a] = head[h];
+			head[h] = a;
+			m_attributeRank[n++] = a;
+		}
+		m_columnOf[a] = r;
+		m_columnCount[r]++;
+	}
+	m_numUsed = n;
+	m_numDistinctColumns = n;
+	for (i = 0; i < n; i++) {
+		if (m_attributeRank[i] == m_classIndex) {
+			m_numDistinctColumns--;
+		}
+	}
+
+	free (head);
+	free (chain);
+	free (hash);
+}
+
+/** Gives every collapsed attribute the final weight of its first */
+static void fanOutColumns ()
+{
+	int a;
+
+	for (a = 0; a < m_numAttribs; a++) {
+		if (m_columnOf[a] >= 0) {
+			m_finalWeights[a] = m_finalWeights[m_columnOf[a]];
+		}
+	}
+}
+
+/** FNV-1a hash of a row's bytes */
+static uint64_t hashRow (data_t * row, size_t bytes)
+{
+	unsigned char *p = (unsigned char *) row;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < bytes; i++) {
+		hash = (hash ^ p[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**
+  * Groups identical rows, comparing every attribute and the class, so that
+  * only instances of a class are grouped (see m_groupOf).  Rows are hashed
+  * into a table of twice their number, chaining the groups in a bucket.
+  */
+static void groupRows ()
+{
+	int i, g, h, size, *head, *chain, *next;
+	size_t bytes = sizeof (data_t) * m_numAttribs;
+	data_t *row;
+
+	for (size = 1; size < 2 * m_numInstances; size <<= 1);
+	head = (int *) malloc_dbg (117, sizeof (int) * size);
+	chain = (int *) malloc_dbg (118, sizeof (int) * m_numInstances);
+	next = (int *) malloc_dbg (119, sizeof (int) * m_numInstances);
+	m_groupOf = (int *) malloc_dbg (120, sizeof (int) * m_numInstances);
+	memset (head, -1, sizeof (int) * size);
+
+	// next[g] holds group g's first member until the members are listed
+	m_numGroups = 0;
+	for (i = 0; i < m_numInstances; i++) {
+		row = m_instances[i]->data;
+		h = hashRow (row, bytes) & (size - 1);
+		for (g = head[h]; g >= 0 && memcmp (m_instances[next[g]]->data,
+						    row, bytes) != 0;
+		     g = chain[g]);
+		if (g < 0) {
+			g = m_numGroups++;
+			next[g] = i;
+			chain[g] = head[h];
+			head[h] = g;
+		}
+		m_groupOf[i] = g;
+	}
+
+	m_groupStart = (int *) malloc_dbg (121,
+					   sizeof (int) * (m_numGroups + 1));
+	m_groupMembers = (int *) malloc_dbg (122,
+					     sizeof (int) * m_numInstances);
+	memset (m_groupStart, 0, sizeof (int) * (m_numGroups + 1));
+	for (i = 0; i < m_numInstances; i++) {
+		m_groupStart[m_groupOf[i] + 1]++;
+	}
+	for (g = 0; g < m_numGroups; g++) {
+		m_groupStart[g + 1] += m_groupStart[g];
+		next[g] = m_groupStart[g];
+	}
+	for (i = 0; i < m_numInstances; i++) {
+		m_groupMembers[next[m_groupOf[i]]++] = i;
+	}
+
+	free (head);
+	free (chain);
+	free (next);
+}
+
+static void releaseGroups ()
+{
+	free (m_groupOf);
+	free (m_groupStart);
+	free (m_groupMembers);
+	m_groupOf = null;
+}
+
+/**
+  * A query's neighbours, with the rows grouped: the distance to a group is
+  * computed once, and its members offered to the list in index order until
+  * one does not make it, the later ones being no nearer.  The lists come
+  * out as a search over every instance would leave them.  The query's
+  * other members are neighbours at distance 0.
+  *
+  * @param q the index of the query instance
+  * @param lists the per-class neighbour lists to fill
+  */
+static void groupSearch (int q, neighbour_t * lists)
+{
+	int g, m, i, cl;
+	double d;
+
+	for (i = 0; i < m_rowLength; i++) {
+		lists[i].dist = DBL_MAX;
+		lists[i].index = -1;
+	}
+	for (g = 0; g < m_numGroups; g++) {
+		i = m_groupMembers[m_groupStart[g]];
+		if (m_codes != null) {
+			d = codedDistance (q, i);
+		} else {
+			d = distance (m_instances[q], m_instances[i]);
+		}
+		cl = m_instances[i]->data[m_classIndex].ival;
+
+		for (m = m_groupStart[g]; m < m_groupStart[g + 1]; m++) {
+			i = m_groupMembers[m];
+			if (i != q && !insertSorted (lists + cl * m_Knn, d, i)) {
+				break;
+			}
+		}
+	}
+	m_scanDistances += m_numGroups;
+}
+
+/**
+  * Processes the queries a group at a time (see groupRows), each distinct
+  * row once, counted the times its members were drawn: the members of a
+  * group have the same neighbours but for one another, at distance 0 and
+  * contributing nothing, so they contribute alike.  Groups with draws are
+  * shared round-robin.
+  *
+  * @param total the number of queries drawn
+  * @param my_rank this rank
+  * @param num_nodes the number of ranks
+  * @param lists the per-class neighbour lists
+  * @param fixed the fixed-point raw weight sums, with the integer kernel,
+  * or null
+  * @param sums the raw weight sums otherwise
+  */
+static void queryGroups (int total, int my_rank, int num_nodes,
+			 neighbour_t * lists, int64_t * fixed, double *sums)
+{
+	int g, q, s, *times;
+	double *byRank = (m_weightByDistance) ? m_weightsByRank : null;
+
+	times = (int *) malloc_dbg (123, sizeof (int) * m_numGroups);
+	memset (times, 0, sizeof (int) * m_numGroups);
+	for (s = 0; s < total; s++) {
+		times[m_groupOf[sampleInstance (s)]]++;
+	}
+
+	for (g = 0, s = 0; g < m_numGroups; g++) {
+		if (times[g] == 0 || s++ % num_nodes != my_rank) {
+			continue;
+		}
+		q = m_groupMembers[m_groupStart[g]];
+		metrics_begin (PHASE_SEARCH);
+		groupSearch (q, lists);
+		metrics_end (PHASE_SEARCH);
+		metrics_begin (PHASE_UPDATE);
+		if (fixed != null && !m_rescore) {
+			fixedAccumulate (q, lists, times[g], fixed);
+		} else {
+			rescoreLists (q, lists);
+			accumulateQuery (q, lists, m_Knn, byRank, sums,
+					 times[g]);
+		}
+		metrics_end (PHASE_UPDATE);
+	}
+	free (times);
+}
+
+/**
+  * Fills in the keys of the approximate neighbour tables.  Each of a key's
+  * m_lshBits parts samples an attribute in use: a nominal one's value
+  * (bit sampling), or whether a numeric one's normalized value reaches a
+  * random threshold, a projection onto its axis.  Either way two instances
+  * agree on a part with a probability that falls with their difference in
+  * its attribute, so near instances tend to share keys.  The attributes and
+  * thresholds are drawn from the seeded stream RNG_STREAM_LSH, the same on
+  * every rank.
+  */
+static void lshKeys ()
+{
+	int t, f, i, a, n, *attrs;
+	uint64_t key = rng_key (m_seed), c;
+	double threshold;
+	data_t *x;
+
+	attrs = (int *) malloc_dbg (135, sizeof (int) * m_numUsed);
+	for (i = n = 0; i < m_numUsed; i++) {
+		if (m_attributeRank[i] != m_classIndex) {
+			attrs[n++] = m_attributeRank[i];
+		}
+	}
+
+	for (t = 0; t < m_lshTables; t++) {
+		for (f = 0; f < m_lshBits && n > 0; f++) {
+			c = (uint64_t) t *m_lshBits + f;
+			a = attrs[rng_below (key, RNG_STREAM_LSH, 2 * c, n)];
+			threshold = rng_uniform (key, RNG_STREAM_LSH, 2 * c + 1);
+
+			for (i = 0; i < m_numInstances; i++) {
+				x = m_instances[i]->data;
+				lsh_add_part (m_lsh, t, f, i,
+					      (m_attributes[a]->type ==
+					       ATTR_NOMINAL)
+					      ? (uint64_t) x[a].ival
+					      : (norm (x[a].fval, a) >=
+						 threshold));
+			}
+		}
+	}
+	free (attrs);
+}
+
+/** Offers instance i to a query's lists, at its exact distance */
+static void lshOffer (int q, int i, neighbour_t * lists)
+{
+	double d;
+
+	if (m_codes != null) {
+		d = codedDistance (q, i);
+	} else {
+		d = distance (m_instances[q], m_instances[i]);
+	}
+	insertSorted (lists + m_instances[i]->data[m_classIndex].ival * m_Knn,
+		      d, i);
+	m_lshExamined++;
+}
+
+/**
+  * A query's approximate neighbours: the nearest, by exact distance, of
+  * the instances sharing its bucket in any table.  While any class is too
+  * short of them to fill its list, the buckets are widened a part at a
+  * time, down to the whole table, so every list ends up as full as an
+  * exact search would leave it.
+  *
+  * @param q the index of the query instance
+  * @param lists the per-class neighbour lists to fill
+  */
+static void lshSearch (int q, neighbour_t * lists)
+{
+	int t, e, i, c, n, p;
+	int cq = m_instances[q]->data[m_classIndex].ival;
+	lsh_entry_t *bucket;
+
+	for (i = 0; i < m_rowLength; i++) {
+		lists[i].dist = DBL_MAX;
+		lists[i].index = -1;
+	}
+
+	// each instance is examined once per search, found in however many
+	// of the query's buckets
+	m_lshSearches++;
+	m_lshStamp[q] = m_lshSearches;
+	for (p = m_lshBits, c = 0; p >= 0 && c < m_numClasses; p--) {
+		for (t = 0; t < m_lshTables; t++) {
+			bucket = lsh_bucket (m_lsh, t, q, p, &n);
+			for (e = 0; e < n; e++) {
+				i = bucket[e].index;
+				if (m_lshStamp[i] != m_lshSearches) {
+					m_lshStamp[i] = m_lshSearches;
+					lshOffer (q, i, lists);
+				}
+			}
+		}
+		for (c = 0; c < m_numClasses; c++) {
+			n = m_classCounts[c] - (c == cq);
+			if (n > m_Knn) {
+				n = m_Knn;
+			}
+			if (n > 0 && lists[c * m_Knn + n - 1].index < 0) {
+				break;
+			}
+		}
+	}
+}
+
+/**
+  * Processes the queries with approximate neighbours (see lshSearch),
+  * shared round-robin.  Every rank builds the same tables over all the
+  * instances.
+  *
+  * @param total the number of queries drawn
+  * @param my_rank this rank
+  * @param num_nodes the number of ranks
+  * @param lists the per-class neighbour lists
+  * @param fixed the fixed-point raw weight sums, with the integer kernel,
+  * or null
+  * @param sums the raw weight sums otherwise
+  */
+static void queryApproximate (int total, int my_rank, int num_nodes,
+			      neighbour_t * lists, int64_t * fixed,
+			      double *sums)
+{
+	int i, s, q;
+	double *byRank = (m_weightByDistance) ? m_weightsByRank : null;
+
+	m_lsh = lsh_create (m_lshTables, m_lshBits, m_numInstances);
+	lshKeys ();
+	lsh_build (m_lsh);
+
+	m_classCounts = (int *) malloc_dbg (136, sizeof (int) * m_numClasses);
+	m_lshStamp = (int *) malloc_dbg (137, sizeof (int) * m_numInstances);
+	memset (m_classCounts, 0, sizeof (int) * m_numClasses);
+	memset (m_lshStamp, 0, sizeof (int) * m_numInstances);
+	for (i = 0; i < m_numInstances; i++) {
+		m_classCounts[m_instances[i]->data[m_classIndex].ival]++;
+	}
+
+	m_lshSearches = 0;
+	m_lshExamined = 0;
+	for (s = my_rank; s < total; s += num_nodes) {
+		q = sampleInstance (s);
+		metrics_begin (PHASE_SEARCH);
+		lshSearch (q, lists);
+		metrics_end (PHASE_SEARCH);
+		metrics_begin (PHASE_UPDATE);
+		if (fixed != null && !m_rescore) {
+			fixedAccumulate (q, lists, 1, fixed);
+		} else {
+			rescoreLists (q, lists);
+			accumulateQuery (q, lists, m_Knn, byRank, sums, 1.0);
+		}
+		metrics_end (PHASE_UPDATE);
+	}
+
+	m_scanDistances += m_lshExamined;
+#ifndef NO_MPI
+	MPI_Allreduce (MPI_IN_PLACE, &m_lshExamined, 1, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+#endif
+	m_lshCandidates = (total > 0) ? m_lshExamined / total : 0;
+
+	lsh_release (m_lsh);
+	free (m_classCounts);
+	free (m_lshStamp);
+	m_lsh = null;
+}
+
+/** The distance between instances a and b, for the metric trees */
+static double treeDistance (int a, int b, void *arg)
+{
+	if (m_codes != null) {
+		return codedDistance (a, b);
+	}
+	return distance (m_instances[a], m_instances[b]);
+}
+
+/** Offers a neighbour to a class's list; the radius is its k-th nearest */
+static double treeOffer (int index, double dist, void *arg)
+{
+	neighbour_t *list = (neighbour_t *) arg;
+
+	insertSorted (list, dist, index);
+	return (list[m_Knn - 1].index >= 0) ? list[m_Knn - 1].dist : DBL_MAX;
+}
+
+/**
+  * Builds a vantage-point tree over each class's instances (see
+  * m_useTrees), the same on every rank.
+  */
+static void buildTrees ()
+{
+	int i, cl, n, *members;
+
+	members = (int *) malloc_dbg (142, sizeof (int) * m_numInstances);
+	m_trees = (vp_tree_t **) malloc_dbg (143, sizeof (vp_tree_t *) *
+					     m_numClasses);
+	m_treeBuilt = m_treeVisited = m_treeComputed = 0;
+
+	for (cl = 0; cl < m_numClasses; cl++) {
+		for (i = n = 0; i < m_numInstances; i++) {
+			if (m_instances[i]->data[m_classIndex].ival == cl) {
+				members[n++] = i;
+			}
+		}
+		m_trees[cl] = vp_build (members, n, treeDistance, null,
+					rng_key (m_seed),
+					RNG_STREAM_VPTREE + cl);
+		m_treeBuilt += m_trees[cl]->built;
+	}
+	free (members);
+}
+
+/**
+  * Frees the metric trees, leaving the search counters per query, added
+  * up over the ranks.
+  *
+  * @param total the number of queries
+  */
+static void releaseTrees (int total)
+{
+	int cl;
+
+	for (cl = 0; cl < m_numClasses; cl++) {
+		m_treeVisited += m_trees[cl]->visited;
+		m_treeComputed += m_trees[cl]->computed;
+		vp_release (m_trees[cl]);
+	}
+	free (m_trees);
+	m_trees = null;
+	m_scanDistances += m_treeComputed;
+
+#ifndef NO_MPI
+	MPI_Allreduce (MPI_IN_PLACE, &m_treeVisited, 1, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+	MPI_Allreduce (MPI_IN_PLACE, &m_treeComputed, 1, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+#endif
+	if (total > 0) {
+		m_treeVisited /= total;
+		m_treeComputed /= total;
+	}
+}
+
+/**
+  * A query's exact neighbours from the metric trees, each class's list
+  * filled from its own tree, its k-th nearest so far the pruning radius.
+  *
+  * @param q the index of the query instance
+  * @param lists the per-class neighbour lists to fill
+  */
+static void treeSearch (int q, neighbour_t * lists)
+{
+	int i, cl;
+
+	for (i = 0; i < m_rowLength; i++) {
+		lists[i].dist = DBL_MAX;
+		lists[i].index = -1;
+	}
+	for (cl = 0; cl < m_numClasses; cl++) {
+		vp_search (m_trees[cl], q, treeOffer, lists + cl * m_Knn);
+	}
+}
+
+/**
+  * The number of leading instances a saved state can be trusted for: all
+  * it covers if it was built with the current options, from the same rows,
+  * and with the same numeric ranges (a range that moves changes every
+  * distance); else none.
+  */
+static int reusableState (arff_info_t * data, relief_state_t * state)
+{
+	int i;
+
+	if (state == null || state->num_attributes != m_numAttribs
+	    || state->class_index != m_classIndex
+	    || state->num_classes != m_numClasses
+	    || state->num_instances > m_numInstances
+	    || state->knn != m_Knn || state->sigma != m_sigma
+	    || state->weight_by_distance != m_weightByDistance
+	    || state->difference != m_difference
+	    || state->checksum != state_checksum (data,
+						  state->num_instances)) {
+		return 0;
+	}
+
+	for (i = 0; i < m_numAttribs; i++) {
+		if (m_attributes[i]->type == ATTR_NUMERIC
+		    && (state->min[i] != m_minArray[i]
+			|| state->max[i] != m_maxArray[i])) {
+			return 0;
+		}
+	}
+
+	return state->num_instances;
+}
+
+/**
+  * ReliefF over all instances, picking up from a saved state where it can.
+  *
+  * If the state covers the first instances of data (see reusableState),
+  * only the instances appended since are new work.  Each is a query with
+  * fresh neighbour lists, and each old query's lists take in the appended
+  * instances.  Where that changes them, the old contribution to the weight
+  * sums is swapped for the new.  Otherwise every list is built from scratch.
+  * Either way the queries are dealt round-robin to the ranks and the lists
+  * and sums merged afterwards, so every rank ends up with the whole state.
+  *
+  * @param data set of instances serving as training data
+  * @param weights the final attribute weights
+  * @param state the state of an earlier run, or null; released here
+  * @return the state for data
+  */
+relief_state_t *buildEvaluatorIncremental (arff_info_t * data,
+					   double *weights,
+					   relief_state_t * state)
+{
+	int i, j, q, cl, old, num_nodes, my_rank;
+	size_t numSums;
+	neighbour_t *table, *row, *before;
+	double *sums, *byRank;
+	double t0, t1;
+	relief_state_t *next;
+
+#ifdef NO_MPI
+	t0 = metrics_now ();
+	num_nodes = 1;
+	my_rank = 0;
+#else
+	t0 = MPI_Wtime ();
+	MPI_Comm_size (MPI_COMM_WORLD, &num_nodes);
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	initEvaluator (data, weights);
+
+	m_rowLength = m_numClasses * m_Knn;
+	numSums = (size_t) m_numClasses * m_numClasses * m_numAttribs;
+	byRank = (m_weightByDistance) ? m_weightsByRank : null;
+
+	table = (neighbour_t *) malloc_dbg (66,
+					    sizeof (neighbour_t) *
+					    m_numInstances * m_rowLength);
+	sums = (double *) malloc_dbg (67, sizeof (double) * numSums);
+	before = (neighbour_t *) malloc_dbg (68,
+					     sizeof (neighbour_t) *
+					     m_rowLength);
+	memset (sums, 0, sizeof (double) * numSums);
+
+	old = reusableState (data, state);
+	if (old > 0) {
+		memcpy (table, state->lists,
+			sizeof (neighbour_t) * old * m_rowLength);
+		// the saved sums are counted once, on rank 0
+		if (my_rank == 0) {
+			memcpy (sums, state->sums, sizeof (double) * numSums);
+		}
+	}
+	for (i = old * m_rowLength; i < m_numInstances * m_rowLength; i++) {
+		table[i].dist = DBL_MAX;
+		table[i].index = -1;
+	}
+	release_state (state);
+
+	// old queries: only the appended instances can be new neighbours
+	for (q = my_rank; q < old; q += num_nodes) {
+		row = table + q * m_rowLength;
+		memcpy (before, row, sizeof (neighbour_t) * m_rowLength);
+
+		for (i = old; i < m_numInstances; i++) {
+			cl = m_instances[i]->data[m_classIndex].ival;
+			insertSorted (row + cl * m_Knn,
+				      distance (m_instances[i],
+						m_instances[q]), i);
+		}
+
+		for (j = 0; j < m_rowLength; j++) {
+			if (before[j].index != row[j].index) {
+				accumulateQuery (q, before, m_Knn, byRank,
+						 sums, -1.0);
+				accumulateQuery (q, row, m_Knn, byRank, sums,
+						 1.0);
+				break;
+			}
+		}
+	}
+
+	// new queries
+	for (q = old + my_rank; q < m_numInstances; q += num_nodes) {
+		row = table + q * m_rowLength;
+
+		for (i = 0; i < m_numInstances; i++) {
+			if (i != q) {
+				cl = m_instances[i]->data[m_classIndex].ival;
+				insertSorted (row + cl * m_Knn,
+					      distance (m_instances[i],
+							m_instances[q]), i);
+			}
+		}
+
+		accumulateQuery (q, row, m_Knn, byRank, sums, 1.0);
+	}
+
+#ifndef NO_MPI
+	// each rank contributes only the lists of its own queries
+	for (q = 0; q < m_numInstances; q++) {
+		if (q % num_nodes != my_rank) {
+			row = table + q * m_rowLength;
+			for (j = 0; j < m_rowLength; j++) {
+				row[j].dist = DBL_MAX;
+				row[j].index = -1;
+			}
+		}
+	}
+	mergeTables (table, m_numInstances, MPI_COMM_WORLD);
+	MPI_Allreduce (MPI_IN_PLACE, sums, numSums, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+#endif
+
+	sumsToWeights (sums, m_numInstances);
+
+	next = (relief_state_t *) malloc_dbg (69, sizeof (relief_state_t));
+	next->num_attributes = m_numAttribs;
+	next->class_index = m_classIndex;
+	next->num_classes = m_numClasses;
+	next->num_instances = m_numInstances;
+	next->knn = m_Knn;
+	next->sigma = m_sigma;
+	next->weight_by_distance = m_weightByDistance;
+	next->difference = m_difference;
+	next->checksum = state_checksum (data, m_numInstances);
+	next->min = (double *) malloc_dbg (70, sizeof (double) * m_numAttribs);
+	next->max = (double *) malloc_dbg (71, sizeof (double) * m_numAttribs);
+	memcpy (next->min, m_minArray, sizeof (double) * m_numAttribs);
+	memcpy (next->max, m_maxArray, sizeof (double) * m_numAttribs);
+	next->sums = sums;
+	next->lists = table;
+
+	free (before);
+
+	m_instancesReused = old;
+	m_instancesUsed = m_numInstances;
+
+	releaseEvaluator ();
+
+#ifdef NO_MPI
+	t1 = metrics_now ();
+#else
+	t1 = MPI_Wtime ();
+#endif
+
+	m_totalTime = t1 - t0;
+
+	return next;
+}
+
+/**
+  * ReliefF for several settings of k, sigma and distance weighting in one
+  * pass.  A single neighbour search per query keeps the nearest of each
+  * class for the largest k, sorted; the nearest for any smaller k are a
+  * prefix of those lists, so every setting takes its own weight sums from
+  * the same search.  With a distance cache directory set, the search walks
+  * the cached rows instead (see distanceCache).
+  *
+  * @param data set of instances serving as training data
+  * @param configs the settings
+  * @param count the number of settings
+  * @param weights the final attribute weights for each setting
+  */
+void buildEvaluatorSweep (arff_info_t * data, relief_config_t * configs,
+			  int count, double **weights)
+{
+	int i, c, s, q, cl, total, knn, num_nodes, my_rank;
+	int *classCounts;
+	size_t numSums;
+	neighbour_t *row;
+	dist_cache_t *cache;
+	double **sums, **byRank;
+	double t0, t1;
+
+#ifdef NO_MPI
+	t0 = metrics_now ();
+	num_nodes = 1;
+	my_rank = 0;
+#else
+	t0 = MPI_Wtime ();
+	MPI_Comm_size (MPI_COMM_WORLD, &num_nodes);
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	// search for the largest k of all settings
+	knn = m_Knn;
+	for (c = 0, m_Knn = 1; c < count; c++) {
+		if (configs[c].knn > m_Knn) {
+			m_Knn = configs[c].knn;
+		}
+	}
+
+	initEvaluator (data, weights[0]);
+
+	m_rowLength = m_numClasses * m_Knn;
+	numSums = (size_t) m_numClasses * m_numClasses * m_numAttribs;
+
+	row = (neighbour_t *) malloc_dbg (72,
+					  sizeof (neighbour_t) * m_rowLength);
+	sums = (double **) malloc_dbg (73, sizeof (double *) * count);
+	byRank = (double **) malloc_dbg (74, sizeof (double *) * count);
+	for (c = 0; c < count; c++) {
+		sums[c] = (double *) malloc_dbg (75, sizeof (double) * numSums);
+		memset (sums[c], 0, sizeof (double) * numSums);
+
+		byRank[c] = null;
+		if (configs[c].weight_by_distance) {
+			byRank[c] = (double *) malloc_dbg (76,
+							   sizeof (double) *
+							   configs[c].knn);
+			for (i = 0; i < configs[c].knn; i++) {
+				byRank[c][i] =
+					exp (-((i / (double) configs[c].sigma)
+					       * (i /
+						  (double) configs[c].sigma)));
+			}
+		}
+	}
+
+	cache = distanceCache (my_rank, num_nodes, true);
+	classCounts = (int *) malloc_dbg (97, sizeof (int) * m_numClasses);
+	memset (classCounts, 0, sizeof (int) * m_numClasses);
+	for (i = 0; i < m_numInstances; i++) {
+		classCounts[m_instances[i]->data[m_classIndex].ival]++;
+	}
+
+	initSampler (m_numInstances);
+	total = sampleCount ();
+
+	for (s = my_rank; s < total; s += num_nodes) {
+		q = sampleInstance (s);
+
+		if (cache != null) {
+			neighboursFromCache (cache, q, null, classCounts, row);
+		} else {
+			for (i = 0; i < m_rowLength; i++) {
+				row[i].dist = DBL_MAX;
+				row[i].index = -1;
+			}
+			for (i = 0; i < m_numInstances; i++) {
+				if (i != q) {
+					cl = m_instances[i]->
+						data[m_classIndex].ival;
+					insertSorted (row + cl * m_Knn,
+						      distance (m_instances
+								[i],
+								m_instances
+								[q]), i);
+				}
+			}
+		}
+
+		for (c = 0; c < count; c++) {
+			accumulateQuery (q, row, configs[c].knn, byRank[c],
+					 sums[c], 1.0);
+		}
+	}
+
+	for (c = 0; c < count; c++) {
+#ifndef NO_MPI
+		MPI_Allreduce (MPI_IN_PLACE, sums[c], numSums, MPI_DOUBLE,
+			       MPI_SUM, MPI_COMM_WORLD);
+#endif
+		m_finalWeights = weights[c];
+		sumsToWeights (sums[c], total);
+
+		free (sums[c]);
+		free (byRank[c]);
+	}
+	free (sums);
+	free (byRank);
+	free (row);
+	free (classCounts);
+	dcache_release (cache);
+
+	m_instancesUsed = total;
+
+	releaseEvaluator ();
+	m_Knn = knn;
+
+#ifdef NO_MPI
+	t1 = metrics_now ();
+#else
+	t1 = MPI_Wtime ();
+#endif
+
+	m_totalTime = t1 - t0;
+}
+
+/**
+  * Caches the distances from every stride-th instance, starting at first,
+  * to all the others, each row sorted nearest first.  Returns null, with
+  * the error set, if the cache does not fit in memory.
+  */
+static dist_cache_t *buildDistanceCache (int first, int stride)
+{
+	int i, j, q, r;
+	dist_cache_t *cache;
+	dcache_entry_t *row;
+
+	cache = dcache_create (first, stride, m_numInstances);
+	if (cache == null) {
+		return null;
+	}
+
+	for (r = 0, q = first; q < m_numInstances; r++, q += stride) {
+		row = dcache_row (cache, r);
+		for (i = j = 0; i < m_numInstances; i++) {
+			if (i != q) {
+				row[j].dist = (float)
+					distance (m_instances[i],
+						  m_instances[q]);
+				row[j++].index = i;
+			}
+		}
+		dcache_sort_row (cache, r);
+	}
+
+	return cache;
+}
+
+/** Whether ok holds on every rank */
+static boolean everywhere (boolean ok)
+{
+#ifndef NO_MPI
+	MPI_Allreduce (MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN,
+		       MPI_COMM_WORLD);
+#endif
+	return ok;
+}
+
+/**
+  * buildDistanceCache, or null on every rank if it fails on any.
+  */
+static dist_cache_t *builtEverywhere (int first, int stride)
+{
+	dist_cache_t *cache = buildDistanceCache (first, stride);
+
+	if (!everywhere (cache != null)) {
+		dcache_release (cache);
+		set_last_error ("Distance cache too large for memory", 0);
+		return null;
+	}
+	return cache;
+}
+
+/**
+  * The distance cache for every stride-th query, starting at first.
+  *
+  * Without a cache directory (see setDistanceCache) the rows are computed
+  * by buildDistanceCache.  With one, the file there keyed by the data, the
+  * class attribute, the difference metric and the attributes in use is
+  * mapped if it exists.  If not, each rank computes its rows as usual and
+  * writes them into a new file, which rank 0 moves into place once all of
+  * them are in; failing that is only worth a warning.  The file has the
+  * distances from every query, so a later run on any number of ranks can
+  * skip straight to the weight update.  If this rank's rows do not fit in
+  * memory on every rank, all of them get null, with the error set.
+  *
+  * @param first the first query of this rank
+  * @param stride the step between its queries
+  * @param all whether to map every row, rather than this rank's; this
+  * needs the file, and without one null is returned
+  * @return the cache
+  */
+static dist_cache_t *distanceCache (int first, int stride, boolean all)
+{
+	char *path, *tmp;
+	uint64_t key;
+	int status, pid, my_rank = 0;
+	boolean saved;
+	dist_cache_t *cache;
+
+	if (m_cacheDir == null) {
+		return (all) ? null : builtEverywhere (first, stride);
+	}
+#ifndef NO_MPI
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	key = dcache_key (state_checksum (m_trainInstances, m_numInstances),
+			  m_classIndex, m_difference, m_attributeRank,
+			  m_numUsed);
+	path = (char *) malloc_dbg (93, strlen (m_cacheDir) + 64);
+	tmp = (char *) malloc_dbg (94, strlen (m_cacheDir) + 96);
+	sprintf (path, "%s/relief-%016llx.dcache", m_cacheDir,
+		 (unsigned long long) key);
+
+	cache = dcache_map (path, key, m_numInstances, (all) ? 0 : first,
+			    (all) ? 1 : stride);
+	if (everywhere (cache != null)) {
+		free (path);
+		free (tmp);
+		return cache;
+	}
+	dcache_release (cache);
+
+	cache = builtEverywhere (first, stride);
+	if (cache == null) {
+		if (all && my_rank == 0) {
+			fprintf (stderr, "Not using distance cache %s: %s\n",
+				 path, get_last_error ());
+		}
+		free (path);
+		free (tmp);
+		return null;
+	}
+
+	// a name of rank 0's own, in case another run is writing the file
+	pid = getpid ();
+#ifndef NO_MPI
+	MPI_Bcast (&pid, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#endif
+	sprintf (tmp, "%s.%d.tmp", path, pid);
+
+	status = (my_rank == 0)
+		? dcache_create_file (tmp, key, m_numInstances) : 0;
+	if (everywhere (status == 0)) {
+		status = dcache_store (cache, tmp);
+		if (everywhere (status == 0) && my_rank == 0) {
+			status = dcache_finish_file (tmp, path);
+		}
+	}
+	if (status != 0) {
+		fprintf (stderr, "Could not save distance cache %s: %s\n",
+			 path, get_last_error ());
+	}
+	saved = everywhere (status == 0);
+	if (my_rank == 0 && !saved) {
+		unlink (tmp);
+	}
+
+	if (all) {
+		dcache_release (cache);
+		cache = null;
+		if (saved) {
+			cache = dcache_map (path, key, m_numInstances, 0, 1);
+		}
+		if (!everywhere (cache != null)) {
+			dcache_release (cache);
+			cache = null;
+		}
+	}
+
+	free (path);
+	free (tmp);
+	return cache;
+}
+
+/** The class of instance i, from m_labels if set */
+static int labelOf (int i)
+{
+	return (m_labels != null) ? m_labels[i]
+		: m_instances[i]->data[m_classIndex].ival;
+}
+
+/**
+  * Picks a query's per-class nearest neighbours from its cached row under
+  * the class labels m_labels, or the data's, stopping as soon as every class has all it
+  * can get.
+  *
+  * @param cache the distance cache
+  * @param r the query's row
+  * @param members which instances may be neighbours, or null for all
+  * @param classCounts the number of those instances in each class
+  * @param lists the per-class neighbour lists to fill
+  */
+static void neighboursFromCache (dist_cache_t * cache, int r,
+				 int *members, int *classCounts,
+				 neighbour_t * lists)
+{
+	int i, cl, wanted, n;
+	dcache_entry_t *row = dcache_row (cache, r);
+
+	for (i = 0; i < m_rowLength; i++) {
+		lists[i].dist = DBL_MAX;
+		lists[i].index = -1;
+	}
+	for (cl = 0; cl < m_numClasses; cl++) {
+		m_stored[cl] = 0;
+	}
+
+	// the query itself is not in its row
+	for (cl = wanted = 0; cl < m_numClasses; cl++) {
+		n = classCounts[cl] - (cl == labelOf (dcache_query (cache, r)));
+		wanted += (n < m_Knn) ? n : m_Knn;
+	}
+
+	for (i = 0; i < cache->cols && wanted > 0; i++) {
+		if (members != null && members[row[i].index] == 0) {
+			continue;
+		}
+		cl = labelOf (row[i].index);
+		if (m_stored[cl] < m_Knn) {
+			lists[cl * m_Knn + m_stored[cl]].dist = row[i].dist;
+			lists[cl * m_Knn + m_stored[cl]].index = row[i].index;
+			m_stored[cl]++;
+			wanted--;
+		}
+	}
+}
+
+/**
+  * Fills m_karray with a query's neighbours from a cache of every row, as
+  * findKHitMiss would from the distances.
+  *
+  * @param cache the distance cache
+  * @param q the index of the query instance
+  * @param classCounts the number of instances in each class
+  * @param lists scratch neighbour lists
+  */
+static void karrayFromCache (dist_cache_t * cache, int q, int *classCounts,
+			     neighbour_t * lists)
+{
+	neighboursFromCache (cache, q, null, classCounts, lists);
+	karrayFromLists (lists);
+}
+
+/**
+  * Fills m_karray and m_stored from per-class neighbour lists, for
+  * updateWeightsDiscreteClass.
+  */
+static void karrayFromLists (neighbour_t * lists)
+{
+	int j, cl;
+	neighbour_t *list;
+
+	for (cl = 0; cl < m_numClasses; cl++) {
+		list = lists + cl * m_Knn;
+		for (j = 0; j < m_Knn && list[j].index >= 0; j++) {
+			m_karray[cl][j][0] = list[j].dist;
+			m_karray[cl][j][1] = list[j].index;
+			m_karray[cl][j][2] = list[j].index;
+		}
+		m_stored[cl] = j;
+	}
+}
+
+/**
+  * Weights under the labels in m_labels from the cached rows, summed over
+  * the ranks into weights on every rank.  With a multiplicity per instance,
+  * each instance counts as a query that many times and only instances that
+  * occur at all are neighbours; the class priors must match.
+  *
+  * @param cache the distance cache
+  * @param times the multiplicity of each instance, or null for once each
+  * @param classCounts the number of distinct instances in each class
+  * @param total the number of queries, counting multiplicity
+  * @param lists scratch neighbour lists
+  * @param sums scratch raw weight sums
+  * @param weights the weights
+  */
+static void weightsFromCache (dist_cache_t * cache, int *times,
+			      int *classCounts, int total,
+			      neighbour_t * lists, double *sums,
+			      double *weights)
+{
+	int r, q;
+	size_t numSums = (size_t) m_numClasses * m_numClasses * m_numAttribs;
+	double *byRank = (m_weightByDistance) ? m_weightsByRank : null;
+
+	memset (sums, 0, sizeof (double) * numSums);
+	for (r = 0; r < cache->rows; r++) {
+		q = dcache_query (cache, r);
+		if (times != null && times[q] == 0) {
+			continue;
+		}
+		neighboursFromCache (cache, r, times, classCounts, lists);
+		accumulateQuery (q, lists, m_Knn, byRank, sums,
+				 (times != null) ? times[q] : 1.0);
+	}
+
+#ifndef NO_MPI
+	MPI_Allreduce (MPI_IN_PLACE, sums, numSums, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
+#endif
+
+	m_finalWeights = weights;
+	sumsToWeights (sums, total);
+}
+
+/**
+  * ReliefF with a permutation test of every weight.
+  *
+  * The distances do not depend on the class labels, so each rank computes
+  * those from its share of the queries (round-robin) to all instances once
+  * and keeps them, sorted, in a distance cache.  The observed weights and
+  * those under each of the label permutations only redo the neighbour
+  * selection, walking the cached rows, and the weight update.  A weight's
+  * p-value is the share of permutations, counting the observed labels as
+  * one, with a weight at least as large.  Permutation p shuffles the labels
+  * with the seeded stream RNG_STREAM_PERMUTE + p, so the result does not
+  * depend on the rank count.
+  *
+  * @param data set of instances serving as training data
+  * @param weights the final attribute weights
+  * @param pvalues the p-value of each weight
+  * @param permutations the number of label permutations
+  * @return 0, or -1 with the error set (see get_last_error) if the
+  * distance cache does not fit in memory
+  */
+int buildEvaluatorPermutation (arff_info_t * data, double *weights,
+			       double *pvalues, int permutations)
+{
+	int i, p, num_nodes, my_rank;
+	int *labels, *shuffled, *classCounts, *exceed;
+	double *sums, *null_weights;
+	double t0, t1;
+	neighbour_t *lists;
+	dist_cache_t *cache;
+	rng_perm_t perm;
+
+#ifdef NO_MPI
+	t0 = metrics_now ();
+	num_nodes = 1;
+	my_rank = 0;
+#else
+	t0 = MPI_Wtime ();
+	MPI_Comm_size (MPI_COMM_WORLD, &num_nodes);
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	initEvaluator (data, weights);
+	m_rowLength = m_numClasses * m_Knn;
+
+	cache = distanceCache (my_rank, num_nodes, false);
+	if (cache == null) {
+		releaseEvaluator ();
+		return -1;
+	}
+
+	labels = (int *) malloc_dbg (80, sizeof (int) * m_numInstances);
+	shuffled = (int *) malloc_dbg (81, sizeof (int) * m_numInstances);
+	classCounts = (int *) malloc_dbg (82, sizeof (int) * m_numClasses);
+	exceed = (int *) malloc_dbg (83, sizeof (int) * m_numAttribs);
+	sums = (double *) malloc_dbg (84, sizeof (double) * m_numClasses *
+				      m_numClasses * m_numAttribs);
+	null_weights = (double *) malloc_dbg (85,
+					      sizeof (double) * m_numAttribs);
+	lists = (neighbour_t *) malloc_dbg (86,
+					    sizeof (neighbour_t) *
+					    m_rowLength);
+
+	memset (classCounts, 0, sizeof (int) * m_numClasses);
+	memset (exceed, 0, sizeof (int) * m_numAttribs);
+	for (i = 0; i < m_numInstances; i++) {
+		labels[i] = m_instances[i]->data[m_classIndex].ival;
+		classCounts[labels[i]]++;
+	}
+
+	m_labels = labels;
+	weightsFromCache (cache, null, classCounts, m_numInstances, lists,
+			  sums, weights);
+
+	// a permutation keeps the class counts, and so the priors
+	m_labels = shuffled;
+	for (p = 0; p < permutations; p++) {
+		rng_perm_init (&perm, rng_key (m_seed),
+			       RNG_STREAM_PERMUTE + p, m_numInstances);
+		for (i = 0; i < m_numInstances; i++) {
+			shuffled[i] = labels[rng_perm (&perm, i)];
+		}
+
+		weightsFromCache (cache, null, classCounts, m_numInstances,
+				  lists, sums, null_weights);
+
+		for (i = 0; i < m_numAttribs; i++) {
+			if (null_weights[i] >= weights[i]) {
+				exceed[i]++;
+			}
+		}
+	}
+	m_labels = null;
+
+	for (i = 0; i < m_numAttribs; i++) {
+		pvalues[i] = (exceed[i] + 1.0) / (permutations + 1.0);
+	}
+
+	m_finalWeights = weights;
+	m_instancesUsed = m_numInstances;
+
+	dcache_release (cache);
+	free (labels);
+	free (shuffled);
+	free (classCounts);
+	free (exceed);
+	free (sums);
+	free (null_weights);
+	free (lists);
+
+	releaseEvaluator ();
+
+#ifdef NO_MPI
+	t1 = metrics_now ();
+#else
+	t1 = MPI_Wtime ();
+#endif
+
+	m_totalTime = t1 - t0;
+	return 0;
+}
+
+/**
+  * ReliefF over resampled subsets of the instances: bootstrap replicates
+  * (RESAMPLE_BOOTSTRAP), each drawing as many instances as there are with
+  * replacement, or the training sets of cross-validation folds
+  * (RESAMPLE_FOLDS), each all but one fold of a seeded random split.
+  *
+  * As in buildEvaluatorPermutation the distances are computed once into a
+  * cache, each rank holding the rows of its share of the queries.  Each
+  * subset then only picks neighbours among its own instances from the
+  * cached rows and redoes the weight update.  A bootstrap query drawn
+  * several times counts that many times, and the class priors are those of
+  * the subset; duplicates are a single neighbour candidate.  Numeric
+  * attributes stay normalized by their ranges over all the instances.
+  *
+  * @param data set of instances serving as training data
+  * @param scheme RESAMPLE_BOOTSTRAP or RESAMPLE_FOLDS
+  * @param count the number of replicates or folds
+  * @param weights the attribute weights for each replicate or fold
+  * @return 0, or -1 with the error set (see get_last_error) if the
+  * distance cache does not fit in memory
+  */
+int buildEvaluatorResampled (arff_info_t * data, int scheme, int count,
+			     double **weights)
+{
+	int i, r, total, num_nodes, my_rank;
+	int *labels, *times, *folds, *classCounts;
+	double *sums;
+	double t0, t1;
+	neighbour_t *lists;
+	dist_cache_t *cache;
+	rng_perm_t perm;
+
+#ifdef NO_MPI
+	t0 = metrics_now ();
+	num_nodes = 1;
+	my_rank = 0;
+#else
+	t0 = MPI_Wtime ();
+	MPI_Comm_size (MPI_COMM_WORLD, &num_nodes);
+	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
+#endif
+
+	initEvaluator (data, weights[0]);
+	m_rowLength = m_numClasses * m_Knn;
+
+	cache = distanceCache (my_rank, num_nodes, false);
+	if (cache == null) {
+		releaseEvaluator ();
+		return -1;
+	}
+
+	labels = (int *) malloc_dbg (87, sizeof (int) * m_numInstances);
+	times = (int *) malloc_dbg (88, sizeof (int) * m_numInstances);
+	folds = (int *) malloc_dbg (89, sizeof (int) * m_numInstances);
+	classCounts = (int *) malloc_dbg (90, sizeof (int) * m_numClasses);
+	sums = (double *) malloc_dbg (91, sizeof (double) * m_numClasses *
+				      m_numClasses * m_numAttribs);
+	lists = (neighbour_t *) malloc_dbg (92,
+					    sizeof (neighbour_t) *
+					    m_rowLength);
+
+	for (i = 0; i < m_numInstances; i++) {
+		labels[i] = m_instances[i]->data[m_classIndex].ival;
+	}
+
+	// fold of each instance: its place in a random order, dealt round
+	rng_perm_init (&perm, rng_key (m_seed), RNG_STREAM_FOLDS,
+		       m_numInstances);
+	for (i = 0; i < m_numInstances; i++) {
+		folds[rng_perm (&perm, i)] = i % count;
+	}
+
+	m_labels = labels;
+	for (r = 0; r < count; r++) {
+		memset (times, 0, sizeof (int) * m_numInstances);
+		if (scheme == RESAMPLE_BOOTSTRAP) {
+			for (i = 0; i < m_numInstances; i++) {
+				times[rng_below (rng_key (m_seed),
+						 RNG_STREAM_BOOTSTRAP + r, i,
+						 m_numInstances)]++;
+			}
+		} else {
+			for (i = 0; i < m_numInstances; i++) {
+				times[i] = (folds[i] != r);
+			}
+		}
 
-void setSeed (int s)
-{
-	m_seed = s;
-}
+		memset (classCounts, 0, sizeof (int) * m_numClasses);
+		memset (m_classProbs, 0, sizeof (double) * m_numClasses);
+		for (i = total = 0; i < m_numInstances; i++) {
+			classCounts[labels[i]] += (times[i] > 0);
+			m_classProbs[labels[i]] += times[i];
+			total += times[i];
+		}
+		for (i = 0; i < m_numClasses; i++) {
+			m_classProbs[i] /= total;
+		}
 
-int getSeed ()
-{
-	return m_seed;
-}
+		weightsFromCache (cache, times, classCounts, total, lists,
+				  sums, weights[r]);
+	}
+	m_labels = null;
 
-void setSampleSize (int s)
-{
-	m_sampleM = s;
-}
+	m_finalWeights = weights[0];
+	m_instancesUsed = m_numInstances;
 
-int getSampleSize ()
-{
-	return m_sampleM;
-}
+	dcache_release (cache);
+	free (labels);
+	free (times);
+	free (folds);
+	free (classCounts);
+	free (sums);
+	free (lists);
 
-void setWeightByDistance (boolean b)
-{
-	m_weightByDistance = b;
-}
+	releaseEvaluator ();
 
-boolean getWeightByDistance ()
-{
-	return m_weightByDistance;
-}
+#ifdef NO_MPI
+	t1 = metrics_now ();
+#else
+	t1 = MPI_Wtime ();
+#endif
 
-double getTotalTime ()
-{
-	return m_totalTime;
+	m_totalTime = t1 - t0;
+	return 0;
 }
 
-void setVersion (int version)
-{
-	m_version = version;
-}
+/** A neighbour's contribution to a query, for buildEvaluatorStreamed */
+typedef struct {
+	int index;		/* instance index of the neighbour */
+	int query;		/* the query's place in its block */
+	int cl;			/* the neighbour's class */
+	double w;		/* its weight, times the times the query was drawn */
+} stream_ref_t;
 
-void setDifference (int difference)
+/* Neighbour instance order, to meet them as the rows stream by */
+static int compref (const void *p1, const void *p2)
 {
-	m_difference = difference;
+	const stream_ref_t *a = (const stream_ref_t *) p1;
+	const stream_ref_t *b = (const stream_ref_t *) p2;
+
+	return (a->index < b->index) ? -1 : (a->index > b->index);
 }
 
 /**
-  * Initializes a ReliefF attribute evaluator. 
+  * Out-of-core ReliefF, for data larger than memory, from a row file.
   *
-  * @param data set of instances serving as training data 
-  * @throws Exception if the evaluator has not been 
-  * generated successfully
+  * The rows are only ever read in blocks, two buffers of them, a helper
+  * thread reading the next block while the current one is used (see
+  * rows_stream).  A first pass over each rank's share of the rows finds the
+  * class priors and numeric ranges.  The queries of each rank are then
+  * taken a block at a time, in instance order: one pass over all the rows
+  * finds their neighbours, kept as in buildEvaluatorSweep, and a second
+  * pass over the rows from the first neighbour to the last adds their
+  * contributions to the weight sums (see accumulateQuery).  Both passes
+  * read sequentially.
+  *
+  * Half the memory limit goes to the row buffers, half to the block of
+  * queries with their neighbour lists; besides these, each rank holds a
+  * count per instance.
+  *
+  * @param file the row file
+  * @param weights the final attribute weights
+  * @param memory the memory limit, in bytes
+  * @return 0, or -1 with the error set (see get_last_error) if the rows
+  * could not be read
   */
-void buildEvaluator (arff_info_t * data, double *weights)
+int buildEvaluatorStreamed (row_file_t * file, double *weights,
+			    size_t memory)
 {
-
-	int i, j, k, z, totalInstances;
-	int num_nodes, my_rank;
+	int i, a, b, e, k, n, q, cl, cq, first, count, block;
+	int numQueries, queryBlock;
+	int total, numRefs, num_nodes, my_rank, status = 0;
+	int *queries, *times, *classCounts;
+	size_t numSums, perQuery;
+	double *sums, *row;
+	double *byRank;
 	double t0, t1;
-#ifdef PRINT_STATUS
-	char buf[100];
-#endif
-
-	srand (time (NULL));
+	data_t *rows, *queryRows;
+	neighbour_t *lists, *list;
+	stream_ref_t *refs;
+	row_stream_t *stream;
+	instance_t cand, query;
 
 #ifdef NO_MPI
-	t0 = (double) clock () / CLOCKS_PER_SEC;
+	t0 = metrics_now ();
 	num_nodes = 1;
 	my_rank = 0;
 #else
@@ -204,220 +3683,223 @@ void buildEvaluator (arff_info_t * data, double *weights)
 	MPI_Comm_rank (MPI_COMM_WORLD, &my_rank);
 #endif
 
-	m_trainInstances = data;
-	m_classIndex = m_trainInstances->class_index;
-	m_numAttribs = m_trainInstances->num_attributes;
-	m_numInstances = m_trainInstances->num_instances;
-	m_attributes = m_trainInstances->attributes;
-	m_instances = m_trainInstances->instances;
-
-	m_numClasses = m_attributes[m_classIndex]->nom_info->num_classes;
+	initEvaluator (file->info, weights);
+	m_rowLength = m_numClasses * m_Knn;
+	numSums = (size_t) m_numClasses * m_numClasses * m_numAttribs;
+	byRank = (m_weightByDistance) ? m_weightsByRank : null;
 
-	if (m_weightByDistance)	// set up the rank based weights
-	{
-		m_weightsByRank =
-			(double *) malloc_dbg (1, sizeof (double) * m_Knn);
+	block = memory / 4 / file->row_size;
+	if (block > INT_MAX / file->row_size) {
+		block = INT_MAX / file->row_size;
+	}
+	if (block > m_numInstances) {
+		block = m_numInstances;
+	}
+	if (block < 1) {
+		block = 1;
+	}
+	perQuery = file->row_size +
+		m_rowLength * (sizeof (neighbour_t) + sizeof (stream_ref_t));
+	queryBlock = memory / 2 / perQuery;
+	if (queryBlock > INT_MAX / perQuery) {
+		queryBlock = INT_MAX / perQuery;
+	}
+	if (queryBlock < 1) {
+		queryBlock = 1;
+	}
 
-		for (i = 0; i < m_Knn; i++) {
-			m_weightsByRank[i] =
-				exp (-
-				     ((i / (double) m_sigma) *
-				      (i / (double) m_sigma)));
+	// class priors and numeric ranges, from each rank's share of the rows
+	metrics_begin (PHASE_MINMAX);
+	classCounts = (int *) malloc_dbg (104, sizeof (int) * m_numClasses);
+	memset (classCounts, 0, sizeof (int) * m_numClasses);
+	stream = rows_stream (file,
+			      (int) ((long long) m_numInstances * my_rank /
+				     num_nodes),
+			      (int) ((long long) m_numInstances *
+				     (my_rank + 1) / num_nodes), block);
+	while ((rows = rows_next (stream, &first, &count)) != null) {
+		for (i = 0; i < count; i++) {
+			cand.data = rows + (size_t) i * m_numAttribs;
+			classCounts[cand.data[m_classIndex].ival]++;
+			updateMinMax (&cand);
 		}
 	}
-	// the final attribute weights
-#ifdef NO_MPI
-	m_weights = m_finalWeights = weights;
-#else
-	m_weights = (double *) malloc_dbg (2, sizeof (double) * m_numAttribs);
-	m_finalWeights = weights;
-#endif
-
-
-	m_attributeRank = (int *) malloc_dbg (3, sizeof (int) * m_numAttribs);
+	status |= rows_stream_end (stream);
+	metrics_end (PHASE_MINMAX);
 
+#ifndef NO_MPI
+	MPI_Allreduce (MPI_IN_PLACE, classCounts, m_numClasses, MPI_INT,
+		       MPI_SUM, MPI_COMM_WORLD);
 	for (i = 0; i < m_numAttribs; i++) {
-		m_attributeRank[i] = i;
+		if (m_minArray[i] == DBL_MAX) {
+			m_maxArray[i] = -DBL_MAX;
+		}
 	}
-	m_numExcludedAttributes = 0;
-
+	MPI_Allreduce (MPI_IN_PLACE, m_minArray, m_numAttribs, MPI_DOUBLE,
+		       MPI_MIN, MPI_COMM_WORLD);
+	MPI_Allreduce (MPI_IN_PLACE, m_maxArray, m_numAttribs, MPI_DOUBLE,
+		       MPI_MAX, MPI_COMM_WORLD);
 	for (i = 0; i < m_numAttribs; i++) {
-		m_weights[i] = m_finalWeights[i] = 0.0;
+		if (m_minArray[i] == DBL_MAX) {
+			m_maxArray[i] = DBL_MAX;
+		}
 	}
-	// num classes (1 for numeric class) knn neighbours, 
-	// and 0 = distance, 1 = instance index
-	m_karray =
-		(double ***) malloc_dbg (4,
-					 sizeof (double **) * m_numClasses);
+#endif
 	for (i = 0; i < m_numClasses; i++) {
-		m_karray[i] =
-			(double **) malloc_dbg (5, sizeof (double *) * m_Knn);
-		for (j = 0; j < m_Knn; j++) {
-			m_karray[i][j] =
-				(double *) malloc_dbg (6,
-						       sizeof (double) * 2);
-		}
+		m_classProbs[i] = classCounts[i] / (double) m_numInstances;
 	}
 
-	m_classProbs =
-		(double *) malloc_dbg (7, sizeof (double) * m_numClasses);
-
-	for (i = 0; i < m_numInstances; i++) {
-		m_classProbs[m_instances[i]->data[m_classIndex].ival]++;
+	// this rank's queries, in instance order, with the times each was
+	// drawn
+	initSampler (m_numInstances);
+	total = sampleCount ();
+	times = (int *) malloc_dbg (105, sizeof (int) * m_numInstances);
+	memset (times, 0, sizeof (int) * m_numInstances);
+	for (i = my_rank; i < total; i += num_nodes) {
+		times[sampleInstance (i)]++;
 	}
-
-	for (i = 0; i < m_numClasses; i++) {
-		m_classProbs[i] /= m_numInstances;
+	for (q = numQueries = 0; q < m_numInstances; q++) {
+		numQueries += (times[q] > 0);
 	}
-
-	m_worst = (double *) malloc_dbg (8, sizeof (double) * m_numClasses);
-	m_index = (int *) malloc_dbg (9, sizeof (int) * m_numClasses);
-	m_stored = (int *) malloc_dbg (10, sizeof (int) * m_numClasses);
-	m_minArray =
-		(double *) malloc_dbg (11, sizeof (double) * m_numAttribs);
-	m_maxArray =
-		(double *) malloc_dbg (12, sizeof (double) * m_numAttribs);
-
-	tempDistClass =
-		(double *) malloc_dbg (13, sizeof (double) * m_numAttribs);
-	tempDistAtt =
-		(double *) malloc_dbg (14, sizeof (double) * m_numAttribs);
-	tempSortedClass =
-		(int *) malloc_dbg (15, sizeof (int) * m_numAttribs);
-	tempSortedAtt =
-		(int **) malloc_dbg (16, sizeof (int *) * m_numClasses);
-	distNormAtt =
-		(double *) malloc_dbg (17, sizeof (double) * m_numClasses);
-
-	for (i = 0; i < m_numClasses; i++) {
-		if (i != m_classIndex)	// already done cl
-		{
-			tempSortedAtt[i] =
-				(int *) malloc_dbg (18,
-						    sizeof (int) *
-						    m_numAttribs);
+	queries = (int *) malloc_dbg (106, sizeof (int) * (numQueries + 1));
+	for (q = numQueries = 0; q < m_numInstances; q++) {
+		if (times[q] > 0) {
+			queries[numQueries++] = q;
 		}
 	}
-
-	for (i = 0; i < m_numAttribs; i++) {
-		m_minArray[i] = m_maxArray[i] = DBL_MAX;
-	}
-
-	for (i = 0; i < m_numInstances; i++) {
-		updateMinMax (m_instances[i]);
+	if (queryBlock > numQueries) {
+		queryBlock = (numQueries > 0) ? numQueries : 1;
 	}
 
-	if ((m_sampleM > m_numInstances) || (m_sampleM < 0)) {
-		totalInstances = m_numInstances;
-	} else {
-		totalInstances = m_sampleM;
-	}
+	sums = (double *) malloc_dbg (107, sizeof (double) * numSums);
+	memset (sums, 0, sizeof (double) * numSums);
+	queryRows = (data_t *) malloc_dbg (108,
+					   file->row_size * queryBlock);
+	lists = (neighbour_t *) malloc_dbg (109,
+					    sizeof (neighbour_t) *
+					    queryBlock * m_rowLength);
+	refs = (stream_ref_t *) malloc_dbg (110,
+					    sizeof (stream_ref_t) *
+					    queryBlock * m_rowLength);
 
-	// process each instance, updating attribute weights
-	for (i = 0; i < totalInstances; i += num_nodes) {
-#ifdef PRINT_STATUS
-		sprintf (buf, "%05i:%05i", i, totalInstances);
-		printf ("%s\n", buf);
-		fflush (stdout);
-#endif
+	for (b = 0; b < numQueries; b += n) {
+		n = (numQueries - b < queryBlock) ? numQueries - b : queryBlock;
 
-		if (totalInstances == m_numInstances) {
-			z = i + my_rank;
-		} else {
-			z = rand () % m_numInstances;
+		for (q = 0; q < n; q++) {
+			status |= rows_read (file, queries[b + q], 1,
+					     queryRows +
+					     (size_t) q * m_numAttribs);
 		}
-
-		if (z < 0) {
-			z *= -1;
+		for (i = 0; i < n * m_rowLength; i++) {
+			lists[i].dist = DBL_MAX;
+			lists[i].index = -1;
 		}
-		// first clear the knn and worst index stuff for the classes
-		for (j = 0; j < m_numClasses; j++) {
-			m_index[j] = m_stored[j] = 0;
 
-			for (k = 0; k < m_Knn; k++) {
-				m_karray[j][k][0] = m_karray[j][k][1] = 0;
+		// the neighbour search
+		stream = rows_stream (file, 0, m_numInstances, block);
+		while ((rows = rows_next (stream, &first, &count)) != null) {
+			for (q = 0; q < n; q++) {
+				query.data = queryRows +
+					(size_t) q * m_numAttribs;
+				list = lists + q * m_rowLength;
+
+				for (i = 0; i < count; i++) {
+					if (first + i == queries[b + q]) {
+						continue;
+					}
+					cand.data = rows +
+						(size_t) i * m_numAttribs;
+					cl = cand.data[m_classIndex].ival;
+					insertSorted (list + cl * m_Knn,
+						      distance (&cand, &query),
+						      first + i);
+				}
 			}
 		}
+		status |= rows_stream_end (stream);
 
-		if (z < totalInstances) {
-			findKHitMiss (z);
-
-			updateWeightsDiscreteClass (z);
+		// what each neighbour adds, in the order they will be read
+		for (q = numRefs = 0; q < n; q++) {
+			for (cl = 0; cl < m_numClasses; cl++) {
+				list = lists + q * m_rowLength + cl * m_Knn;
+				k = neighbourWeights (list, m_Knn, byRank,
+						      tempWeights);
+				for (e = 0; e < k; e++, numRefs++) {
+					refs[numRefs].index = list[e].index;
+					refs[numRefs].query = q;
+					refs[numRefs].cl = cl;
+					refs[numRefs].w = tempWeights[e] *
+						times[queries[b + q]];
+				}
+			}
 		}
+		if (numRefs == 0) {
+			continue;
+		}
+		qsort (refs, numRefs, sizeof (stream_ref_t), compref);
 
-		if (m_version == 1) {
-#ifndef NO_MPI
-			MPI_Allreduce (m_weights, m_finalWeights,
-				       m_numAttribs, MPI_DOUBLE, MPI_SUM,
-				       MPI_COMM_WORLD);
-			if (my_rank == 0) {
-				memcpy (m_weights, m_finalWeights,
-					m_numAttribs * sizeof (double));
-			} else {
-				memset (m_weights, 0,
-					m_numAttribs * sizeof (double));
+		// the weight update
+		stream = rows_stream (file, refs[0].index,
+				      refs[numRefs - 1].index + 1, block);
+		e = 0;
+		while ((rows = rows_next (stream, &first, &count)) != null) {
+			for (; e < numRefs && refs[e].index < first + count;
+			     e++) {
+				cand.data = rows + (size_t) (refs[e].index -
+							     first) *
+					m_numAttribs;
+				query.data = queryRows +
+					(size_t) refs[e].query * m_numAttribs;
+				cq = query.data[m_classIndex].ival;
+				row = sums + (cq * m_numClasses + refs[e].cl) *
+					m_numAttribs;
+
+				for (i = 0; i < m_numUsed; i++) {
+					a = m_attributeRank[i];
+					if (a != m_classIndex) {
+						row[a] += refs[e].w *
+							difference (a,
+								    query.data,
+								    cand.data);
+					}
+				}
 			}
-#endif
-			index_sort (m_attributeRank, m_finalWeights,
-				    m_numAttribs);
-			m_numExcludedAttributes++;
 		}
+		status |= rows_stream_end (stream);
 	}
 
 #ifndef NO_MPI
-	if (m_version != 1) {
-		MPI_Reduce (m_weights, m_finalWeights, m_numAttribs,
-			    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-	}
-	free (m_weights);
+	MPI_Allreduce (MPI_IN_PLACE, sums, numSums, MPI_DOUBLE, MPI_SUM,
+		       MPI_COMM_WORLD);
 #endif
+	m_finalWeights = weights;
+	sumsToWeights (sums, total);
+	m_instancesUsed = total;
 
-	// now scale weights by 1/m_numInstances (nominal class) or
-	// calculate weights numeric class
-	for (i = 0; i < m_numAttribs; i++) {
-		if (i != m_classIndex) {
-			m_finalWeights[i] *= (1.0 / (double) totalInstances);
-		}
-	}
-
-	if (m_weightByDistance)
-		free (m_weightsByRank);
-	for (i = 0; i < m_numClasses; i++) {
-		for (j = 0; j < m_Knn; j++)
-			free (m_karray[i][j]);
-		free (m_karray[i]);
-	}
-	free (m_karray);
-	free (m_classProbs);
-	free (m_worst);
-	free (m_index);
-	free (m_stored);
-	free (m_minArray);
-	free (m_maxArray);
-
-	for (i = 0; i < m_numClasses; i++) {
-		if (i != m_classIndex)	// already done cl
-		{
-			free (tempSortedAtt[i]);
-		}
-	}
+	free (classCounts);
+	free (times);
+	free (queries);
+	free (sums);
+	free (queryRows);
+	free (lists);
+	free (refs);
 
-	free (tempDistClass);
-	free (tempDistAtt);
-	free (tempSortedClass);
-	free (tempSortedAtt);
-	free (distNormAtt);
-	free (m_attributeRank);
+	releaseEvaluator ();
 
 #ifdef NO_MPI
-	t1 = (double) clock () / CLOCKS_PER_SEC;
+	t1 = metrics_now ();
 #else
 	t1 = MPI_Wtime ();
 #endif
 
 	m_totalTime = t1 - t0;
-}
 
+	if (!everywhere (status == 0)) {
+		set_last_error ("Could not read row file", 0);
+		return -1;
+	}
+	return 0;
+}
 
 /**
   * Evaluates an individual attribute using ReliefF's instance based approach.
@@ -443,6 +3925,16 @@ void resetOptions ()
 	m_sigma = 2;
 	m_weightByDistance = false;
 	m_seed = 1;
+	m_replace = true;
+	m_convergeK = 0;
+	m_cacheDir = null;
+	m_dedup = false;
+	m_collapse = false;
+	m_lshTables = 0;
+	m_useTrees = false;
+	m_sparseBelow = SPARSE_BELOW;
+	m_quantize = false;
+	m_rescore = false;
 }
 
 
@@ -534,12 +4026,15 @@ double distance (instance_t * first, instance_t * second)
 	double distance = 0, diff;
 	int i, a;
 
-	for (i = 0; i < (m_numAttribs - m_numExcludedAttributes); i++) {
+	for (i = 0; i < (m_numUsed - m_numExcludedAttributes); i++) {
 		a = m_attributeRank[i];
 		if (a == m_classIndex) {
 			continue;
 		}
 		diff = difference (a, first->data, second->data);
+		if (m_columnCount != null) {
+			diff *= m_columnCount[a];
+		}
 		//      distance += diff * diff;
 		distance += diff;
 	}
@@ -548,6 +4043,36 @@ double distance (instance_t * first, instance_t * second)
 	return distance;
 }
 
+/**
+  * Calculates the distance between two instances, as distance, if it is
+  * below bound; otherwise something no less than bound, stopping at the
+  * first attribute that gets there.
+  */
+static double distanceBounded (instance_t * first, instance_t * second,
+			       double bound)
+{
+	double distance = 0, diff;
+	int i, a, n = m_numUsed - m_numExcludedAttributes;
+
+	for (i = 0; i < n && distance < bound; i++) {
+		a = m_attributeRank[i];
+		if (a == m_classIndex) {
+			continue;
+		}
+		diff = difference (a, first->data, second->data);
+		if (m_columnCount != null) {
+			diff *= m_columnCount[a];
+		}
+		distance += diff;
+	}
+	m_scanDistances++;
+	m_scanBytes += sizeof (data_t) * i;
+	if (i < n) {
+		m_scanAbandoned++;
+	}
+	return distance;
+}
+
 /**
   * update attribute weights given an instance when the class is discrete
   *
@@ -555,7 +4080,7 @@ double distance (instance_t * first, instance_t * second)
   */
 void updateWeightsDiscreteClass (int instNum)
 {
-	int i, j, k, l;
+	int a, i, j, k, l;
 	int cl;
 	double temp_diff, w_norm = 1.0;
 	double distNormClass = 1.0;
@@ -567,6 +4092,8 @@ void updateWeightsDiscreteClass (int instNum)
 	cl = inst->data[m_classIndex].ival;
 
 	// sort nearest neighbours and set up normalization variables
+	// (equal distances are ordered by instance index, so the result does
+	// not depend on the order the neighbours were found in)
 	if (m_weightByDistance) {
 		// do class (hits) first
 		// sort the distances
@@ -574,11 +4101,13 @@ void updateWeightsDiscreteClass (int instNum)
 		for (j = 0, distNormClass = 0; j < m_stored[cl]; j++) {
 			// copy the distances
 			tempDistClass[j] = m_karray[cl][j][0];
+			tempTieClass[j] = m_karray[cl][j][2];
 			// sum normalizer
 			distNormClass += m_weightsByRank[j];
 		}
 
-		index_sort (tempSortedClass, tempDistClass, m_stored[cl]);
+		index_sort_ties (tempSortedClass, tempDistClass, tempTieClass,
+				 m_stored[cl]);
 
 		for (k = 0; k < m_numClasses; k++) {
 			if (k != cl)	// already done cl
@@ -588,12 +4117,14 @@ void updateWeightsDiscreteClass (int instNum)
 				     j < m_stored[k]; j++) {
 					// copy the distances
 					tempDistAtt[j] = m_karray[k][j][0];
+					tempTieAtt[j] = m_karray[k][j][2];
 					// sum normalizer
 					distNormAtt[k] += m_weightsByRank[j];
 				}
 
-				index_sort (tempSortedAtt[k], tempDistAtt,
-					    m_stored[k]);
+				index_sort_ties (tempSortedAtt[k],
+						 tempDistAtt, tempTieAtt,
+						 m_stored[k]);
 			}
 		}
 	}
@@ -604,14 +4135,20 @@ void updateWeightsDiscreteClass (int instNum)
 		w_norm = (1.0 - m_classProbs[cl]);
 	}
 	// do the k nearest hits of the same class
+	// (neighbours with a negative index are another rank's to update)
 	for (j = 0, temp_diff = 0.0; j < m_stored[cl]; j++) {
 		instance_t *cmp;
-		cmp = (m_weightByDistance)
-			? m_instances[(int)
-				      m_karray[cl][tempSortedClass[j]][1]]
-			: m_instances[(int) m_karray[cl][j][1]];
+		int n = (m_weightByDistance)
+			? (int) m_karray[cl][tempSortedClass[j]][1]
+			: (int) m_karray[cl][j][1];
+
+		if (n < 0) {
+			continue;
+		}
+		cmp = m_instances[n];
 
-		for (k = 0; k < m_numAttribs; k++) {
+		for (a = 0; a < m_numUsed; a++) {
+			k = m_attributeRank[a];
 			if (k == m_classIndex) {
 				continue;
 			}
@@ -641,15 +4178,18 @@ void updateWeightsDiscreteClass (int instNum)
 		{
 			for (j = 0; j < m_stored[k]; j++) {
 				instance_t *cmp;
-				cmp = (m_weightByDistance)
-					? m_instances[(int)
-						      m_karray[k]
-						      [tempSortedAtt[k][j]]
-						      [1]]
-					: m_instances[(int)
-						      m_karray[k][j][1]];
-
-				for (l = 0; l < m_numAttribs; l++) {
+				int n = (m_weightByDistance)
+					? (int) m_karray[k][tempSortedAtt[k][j]]
+					[1]
+					: (int) m_karray[k][j][1];
+
+				if (n < 0) {
+					continue;
+				}
+				cmp = m_instances[n];
+
+				for (a = 0; a < m_numUsed; a++) {
+					l = m_attributeRank[a];
 					if (l == m_classIndex) {
 						continue;
 					}
@@ -693,56 +4233,87 @@ void updateWeightsDiscreteClass (int instNum)
   */
 void findKHitMiss (int instNum)
 {
-	int i, j;
-	int cl;
-	double ww;
-	double temp_diff = 0.0;
+	int i, j, cl;
+	double d, bound;
 	instance_t *thisInst = m_instances[instNum];
 
-	for (i = 0; i < m_numInstances; i++) {
-		if (i != instNum) {
-			instance_t *cmpInst = m_instances[i];
-			temp_diff = distance (cmpInst, thisInst);
-
-			// class of this training instance
-			cl = cmpInst->data[m_classIndex].ival;
-
-			// add this diff to the list for the class of this instance
-			if (m_stored[cl] < m_Knn) {
-				m_karray[cl][m_stored[cl]][0] = temp_diff;
-				m_karray[cl][m_stored[cl]][1] = i;
-				m_stored[cl]++;
-
-				// note the worst diff for this class
-				for (j = 0, ww = -1.0; j < m_stored[cl]; j++) {
-					if (m_karray[cl][j][0] > ww) {
-						ww = m_karray[cl][j][0];
-						m_index[cl] = j;
-					}
+	// a class at a time, in index order: once the class's k are in, a
+	// candidate has to come in below the farthest of them to replace it
+	for (cl = 0; cl < m_numClasses; cl++) {
+		bound = DBL_MAX;
+		for (j = m_classStart[cl]; j < m_classStart[cl + 1]; j++) {
+			i = m_classMembers[j];
+			if (i == instNum) {
+				continue;
+			}
+			d = distanceBounded (m_instances[i], thisInst, bound);
+			if (d < bound) {
+				insertKHitMiss (i, d);
+				if (m_stored[cl] == m_Knn) {
+					bound = m_worst[cl];
 				}
+			}
+		}
+	}
+}
 
-				m_worst[cl] = ww;
-			} else
-				/* if we already have stored knn for this class then check to
-				   see if this instance is better than the worst */
-			{
-				if (temp_diff < m_karray[cl][m_index[cl]][0]) {
-					m_karray[cl][m_index[cl]][0] =
-						temp_diff;
-					m_karray[cl][m_index[cl]][1] = i;
-
-					for (j = 0, ww = -1.0;
-					     j < m_stored[cl]; j++) {
-						if (m_karray[cl][j][0] > ww) {
-							ww = m_karray[cl][j]
-								[0];
-							m_index[cl] = j;
-						}
-					}
+/**
+  * Offers a training instance at a given distance from the current instance
+  * to the nearest hits/misses of its class.
+  *
+  * @param i the index of the training instance
+  * @param temp_diff its distance from the instance in question
+  */
+void insertKHitMiss (int i, double temp_diff)
+{
+	int j;
+	int cl;
+	double ww;
+	instance_t *cmpInst = m_instances[i];
 
-					m_worst[cl] = ww;
+	// class of this training instance
+	cl = cmpInst->data[m_classIndex].ival;
+
+	// add this diff to the list for the class of this instance
+	if (m_stored[cl] < m_Knn) {
+		m_karray[cl][m_stored[cl]][0] = temp_diff;
+		m_karray[cl][m_stored[cl]][1] = i;
+		m_karray[cl][m_stored[cl]][2] = i;
+		m_stored[cl]++;
+
+		// note the worst diff for this class (the later instance wins
+		// ties, so the kept neighbours do not depend on slot order)
+		for (j = 0, ww = -1.0; j < m_stored[cl]; j++) {
+			if (m_karray[cl][j][0] > ww ||
+			    (m_karray[cl][j][0] == ww &&
+			     m_karray[cl][j][2] >
+			     m_karray[cl][m_index[cl]][2])) {
+				ww = m_karray[cl][j][0];
+				m_index[cl] = j;
+			}
+		}
+
+		m_worst[cl] = ww;
+	} else
+		/* if we already have stored knn for this class then check to
+		   see if this instance is better than the worst */
+	{
+		if (temp_diff < m_karray[cl][m_index[cl]][0]) {
+			m_karray[cl][m_index[cl]][0] = temp_diff;
+			m_karray[cl][m_index[cl]][1] = i;
+			m_karray[cl][m_index[cl]][2] = i;
+
+			for (j = 0, ww = -1.0; j < m_stored[cl]; j++) {
+				if (m_karray[cl][j][0] > ww ||
+				    (m_karray[cl][j][0] == ww &&
+				     m_karray[cl][j][2] >
+				     m_karray[cl][m_index[cl]][2])) {
+					ww = m_karray[cl][j][0];
+					m_index[cl] = j;
 				}
 			}
+
+			m_worst[cl] = ww;
 		}
 	}
 }
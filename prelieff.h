@@ -3,8 +3,36 @@
 
 #include "arff.h"
 #include "java.h"
+#include "state.h"
+#include "rows.h"
+
+/* One setting of the neighbour weighting, see buildEvaluatorSweep */
+typedef struct {
+	int knn;
+	int sigma;
+	boolean weight_by_distance;
+} relief_config_t;
+
+/* Resampling schemes for buildEvaluatorResampled */
+#define RESAMPLE_BOOTSTRAP	1
+#define RESAMPLE_FOLDS		2
 
 void buildEvaluator (arff_info_t * data, double *weights);
+void buildEvaluatorPartitioned (arff_info_t * data, double *weights,
+				int batch);
+void buildEvaluatorBlocked (arff_info_t * data, double *weights, int rows,
+			    int cols);
+relief_state_t *buildEvaluatorIncremental (arff_info_t * data,
+					   double *weights,
+					   relief_state_t * state);
+void buildEvaluatorSweep (arff_info_t * data, relief_config_t * configs,
+			  int count, double **weights);
+int buildEvaluatorPermutation (arff_info_t * data, double *weights,
+			       double *pvalues, int permutations);
+int buildEvaluatorResampled (arff_info_t * data, int scheme, int count,
+			     double **weights);
+int buildEvaluatorStreamed (row_file_t * file, double *weights,
+			    size_t memory);
 double evaluateAttribute (int attribute);
 
 void resetOptions ();
@@ -16,10 +44,29 @@ void setSeed (int s);
 int getSeed ();
 void setSampleSize (int s);
 int getSampleSize ();
+void setSampleWithReplacement (boolean b);
+boolean getSampleWithReplacement ();
 void setWeightByDistance (boolean b);
 boolean getWeightByDistance ();
 double getTotalTime ();
 void setVersion (int version);
 void setDifference (int);
+void setActiveAttributes (int *active, int count);
+void setDistanceCache (char *dir);
+void setDeduplicate (boolean b);
+int getDistinctInstances ();
+void setCollapseColumns (boolean b);
+int getDistinctAttributes ();
+void setApproximate (int tables, int bits);
+double getCandidatesPerQuery ();
+void setSparseBelow (double density);
+boolean getSparseUsed ();
+void setQuantize (boolean b, boolean rescore);
+int getQuantizedAttributes ();
+void setMetricTrees (boolean b);
+void getTreeCounters (double *built, double *visited, double *computed);
+void setConvergence (int k, int patience, int check);
+int getInstancesUsed ();
+int getInstancesReused ();
 
 #endif
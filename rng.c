@@ -0,0 +1,80 @@
+#include "rng.h"
+
+#define GOLDEN	0x9e3779b97f4a7c15ULL
+#define ROUNDS	6
+
+/* The SplitMix64 finaliser: a bijection on 64 bits with full avalanche */
+static uint64_t mix (uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Key for a user supplied seed */
+uint64_t rng_key (int seed)
+{
+	return mix ((uint64_t) (unsigned int) seed * GOLDEN + GOLDEN);
+}
+
+/* Draw number counter of a stream: the SplitMix64 sequence whose state
+ * is derived from key and stream, evaluated at position counter.
+ */
+uint64_t rng_u64 (uint64_t key, uint64_t stream, uint64_t counter)
+{
+	return mix (mix (key ^ mix (stream + GOLDEN)) + (counter + 1) * GOLDEN);
+}
+
+/* Uniform in [0, 1) with 53 random bits */
+double rng_uniform (uint64_t key, uint64_t stream, uint64_t counter)
+{
+	return (rng_u64 (key, stream, counter) >> 11) *
+		(1.0 / 9007199254740992.0);
+}
+
+/* Uniform in [0, n), by multiplying out the high 32 bits (bias < n/2^32) */
+int rng_below (uint64_t key, uint64_t stream, uint64_t counter, int n)
+{
+	return (int) (((rng_u64 (key, stream, counter) >> 32) *
+		       (uint64_t) n) >> 32);
+}
+
+/* A random permutation of [0, n), for drawing without replacement: a
+ * balanced Feistel network over the smallest even number of bits covering
+ * n, cycle-walked until the value falls back inside [0, n).
+ */
+void rng_perm_init (rng_perm_t * perm, uint64_t key, uint64_t stream,
+		    int n)
+{
+	int bits = 2;
+
+	while (bits < 62 && ((uint64_t) 1 << bits) < (uint64_t) n) {
+		bits += 2;
+	}
+
+	perm->key = rng_u64 (key, stream, 0);
+	perm->n = n;
+	perm->half = bits / 2;
+	perm->mask = ((uint64_t) 1 << perm->half) - 1;
+}
+
+/* The i-th value of the permutation, 0 <= i < n */
+int rng_perm (const rng_perm_t * perm, int i)
+{
+	uint64_t x = (uint64_t) i;
+	uint64_t l, r, t;
+	int round;
+
+	do {
+		l = x >> perm->half;
+		r = x & perm->mask;
+		for (round = 0; round < ROUNDS; round++) {
+			t = r;
+			r = l ^ (rng_u64 (perm->key, round, r) & perm->mask);
+			l = t;
+		}
+		x = (l << perm->half) | r;
+	} while (x >= (uint64_t) perm->n);
+
+	return (int) x;
+}
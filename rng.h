@@ -0,0 +1,38 @@
+#ifndef _RNG_H
+#define _RNG_H
+
+#include <stdint.h>
+
+/* Counter-based random numbers: every value is a pure function of a key,
+ * a stream and a counter, so any rank or thread can compute any draw
+ * without shared state, and the draws do not depend on who computes them.
+ */
+
+/* Streams in use; each purpose gets its own, so they never overlap */
+#define RNG_STREAM_SAMPLE	1	/* instances to sample */
+#define RNG_STREAM_FOLDS	2	/* cross-validation folds */
+#define RNG_STREAM_LSH		3	/* hashed attributes and thresholds */
+#define RNG_STREAM_VPTREE	4	/* vantage points */
+#define RNG_STREAM_PERMUTE	((uint64_t) 1 << 32)	/* label permutation p uses
+							   this stream + p */
+#define RNG_STREAM_BOOTSTRAP	((uint64_t) 2 << 32)	/* bootstrap replicate r
+							   uses this stream + r */
+
+/* Values n < 2^31 may be permuted; counters stay below 2^64 */
+typedef struct {
+	uint64_t key;
+	int n;
+	int half;		/* bits in each Feistel half */
+	uint64_t mask;		/* low half mask */
+} rng_perm_t;
+
+uint64_t rng_key (int seed);
+uint64_t rng_u64 (uint64_t key, uint64_t stream, uint64_t counter);
+double rng_uniform (uint64_t key, uint64_t stream, uint64_t counter);
+int rng_below (uint64_t key, uint64_t stream, uint64_t counter, int n);
+
+void rng_perm_init (rng_perm_t * perm, uint64_t key, uint64_t stream,
+		    int n);
+int rng_perm (const rng_perm_t * perm, int i);
+
+#endif
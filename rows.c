@@ -0,0 +1,317 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arff.h"
+#include "rows.h"
+#include "trace.h"
+#include "util.h"
+
+/* The row file starts with a small fixed header, saying where the packed
+ * ARFF header is: that is only known once all the rows are written, so it
+ * goes last.  Like a state file, a row file is meant to be read back by the
+ * same build on the same kind of machine.
+ */
+
+#define ROWS_MAGIC	0x53574f52	/* "ROWS" */
+#define ROWS_VERSION	1
+
+/* Bytes per write buffer while converting */
+#define ROWS_WRITE_BUFFER	(1 << 20)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	int32_t num_instances;
+	int32_t num_attributes;
+	uint64_t header_offset;
+	uint64_t header_length;
+} rows_header_t;
+
+typedef struct {
+	FILE *fp;
+	int count;
+	int error;
+} convert_t;
+
+static void write_row (int index, data_t * row, int length, void *arg)
+{
+	convert_t *conv = (convert_t *) arg;
+
+	if (fwrite (row, sizeof (data_t), length, conv->fp) != length)
+		conv->error = 1;
+	conv->count++;
+}
+
+/**
+ * Converts an ARFF file to a row file, a row at a time, so the rows never
+ * need to fit in memory.  Returns 0, or -1 with the error set (see
+ * get_last_error).
+ */
+int rows_convert (char *arff_filename, char *class_attribute_name,
+		  char *filename)
+{
+	arff_filter_t keep = { 1, 0, NULL, write_row, NULL };
+	rows_header_t header;
+	arff_info_t *info;
+	convert_t conv;
+	char *buf;
+	int r = 0;
+
+	conv.fp = fopen (filename, "wb");
+	if (conv.fp == NULL) {
+		set_last_error ("Could not open row file for writing", 0);
+		return -1;
+	}
+	setvbuf (conv.fp, NULL, _IOFBF, ROWS_WRITE_BUFFER);
+	conv.count = 0;
+	conv.error = 0;
+	keep.arg = &conv;
+
+	memset (&header, 0, sizeof (header));
+	fwrite (&header, sizeof (header), 1, conv.fp);
+
+	info = read_arff_filtered (arff_filename, class_attribute_name, &keep);
+	if (info == NULL) {
+		fclose (conv.fp);
+		remove (filename);
+		return -1;
+	}
+
+	header.magic = ROWS_MAGIC;
+	header.version = ROWS_VERSION;
+	header.num_instances = conv.count;
+	header.num_attributes = info->num_attributes;
+	header.header_offset = sizeof (header) + sizeof (data_t) *
+		(uint64_t) conv.count * info->num_attributes;
+
+	info->num_instances = conv.count;
+	header.header_length = arff_pack_header (info, &buf);
+	info->num_instances = 0;	// it holds none of them
+	release_read_info (info);
+
+	if (conv.error
+	    || fwrite (buf, header.header_length, 1, conv.fp) != 1
+	    || fseek (conv.fp, 0, SEEK_SET) != 0
+	    || fwrite (&header, sizeof (header), 1, conv.fp) != 1)
+		r = -1;
+	if (fclose (conv.fp) != 0)
+		r = -1;
+	free (buf);
+
+	if (r != 0) {
+		remove (filename);
+		set_last_error ("Could not write row file", 0);
+	}
+	return r;
+}
+
+/**
+ * Opens a row file, taking the class to be the named attribute.  Returns
+ * NULL, with the error set, if the file cannot be read or has no such
+ * attribute.
+ */
+row_file_t *rows_open (char *filename, char *class_attribute_name)
+{
+	rows_header_t header;
+	row_file_t *file;
+	arff_info_t *info;
+	char *buf;
+	int fd, i;
+
+	fd = open (filename, O_RDONLY);
+	if (fd < 0) {
+		set_last_error ("Could not open row file", 0);
+		return NULL;
+	}
+
+	if (pread (fd, &header, sizeof (header), 0) != sizeof (header)
+	    || header.magic != ROWS_MAGIC || header.version != ROWS_VERSION) {
+		close (fd);
+		set_last_error ("Not a row file of this version", 0);
+		return NULL;
+	}
+
+	buf = (char *) malloc_dbg (99, header.header_length);
+	if (pread (fd, buf, header.header_length, header.header_offset) !=
+	    (ssize_t) header.header_length
+	    || (info = arff_unpack_header (buf, header.header_length)) ==
+	    NULL) {
+		free (buf);
+		close (fd);
+		set_last_error ("Truncated row file", 0);
+		return NULL;
+	}
+	free (buf);
+
+	info->class_index = -1;
+	for (i = 0; i < info->num_attributes; i++) {
+		if (!strcasecmp (info->attributes[i]->name,
+				 class_attribute_name))
+			info->class_index = i;
+	}
+	if (info->class_index < 0) {
+		release_read_info (info);
+		close (fd);
+		set_last_error ("No such class attribute in the row file", 0);
+		return NULL;
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	file = (row_file_t *) malloc_dbg (100, sizeof (row_file_t));
+	file->fd = fd;
+	file->info = info;
+	file->row_size = sizeof (data_t) * info->num_attributes;
+	return file;
+}
+
+/**
+ * Reads count rows starting at row first into buf.  Returns 0, or -1 if
+ * the file is short.
+ */
+int rows_read (row_file_t * file, int first, int count, data_t * buf)
+{
+	char *p = (char *) buf;
+	size_t left = file->row_size * count;
+	off_t offset = sizeof (rows_header_t) + (off_t) file->row_size * first;
+	ssize_t n;
+
+	while (left > 0) {
+		n = pread (file->fd, p, left, offset);
+		if (n <= 0)
+			return -1;
+		p += n;
+		offset += n;
+		left -= n;
+	}
+	return 0;
+}
+
+void rows_close (row_file_t * file)
+{
+	if (file == NULL)
+		return;
+
+	close (file->fd);
+	release_read_info (file->info);
+	free (file);
+}
+
+/* The helper thread: reads the blocks in order, each into whichever buffer
+ * is its turn once the caller is done with it.
+ */
+static void *read_blocks (void *arg)
+{
+	row_stream_t *stream = (row_stream_t *) arg;
+	int b, i, n;
+
+	for (b = stream->first, i = 0;; b += stream->block, i ^= 1) {
+		pthread_mutex_lock (&stream->lock);
+		while (b < stream->end && stream->count[i] >= 0)
+			pthread_cond_wait (&stream->cond, &stream->lock);
+		n = stream->end - b;
+		pthread_mutex_unlock (&stream->lock);
+
+		if (n <= 0)
+			break;
+		if (n > stream->block)
+			n = stream->block;
+
+		trace_begin (SPAN_BLOCK);
+		if (rows_read (stream->file, b, n, stream->buf[i]) != 0)
+			stream->error = 1;
+		trace_end (SPAN_BLOCK);
+
+		pthread_mutex_lock (&stream->lock);
+		stream->count[i] = n;
+		pthread_cond_broadcast (&stream->cond);
+		pthread_mutex_unlock (&stream->lock);
+	}
+	return NULL;
+}
+
+/**
+ * Starts streaming rows [first, end) in blocks of the given number of
+ * rows.  The two buffers take twice the block's rows.
+ */
+row_stream_t *rows_stream (row_file_t * file, int first, int end, int block)
+{
+	row_stream_t *stream;
+	int i;
+
+	stream = (row_stream_t *) malloc_dbg (101, sizeof (row_stream_t));
+	stream->file = file;
+	stream->first = first;
+	stream->end = end;
+	stream->block = block;
+	stream->taken = 0;
+	stream->error = 0;
+	for (i = 0; i < 2; i++) {
+		stream->buf[i] = (data_t *) malloc_dbg (102,
+							file->row_size *
+							block);
+		stream->count[i] = -1;
+	}
+	pthread_mutex_init (&stream->lock, NULL);
+	pthread_cond_init (&stream->cond, NULL);
+	pthread_create (&stream->thread, NULL, read_blocks, stream);
+	return stream;
+}
+
+/**
+ * The next block of rows, handing the previous one back to be refilled;
+ * first and count say which rows it holds.  Returns NULL after the last.
+ */
+data_t *rows_next (row_stream_t * stream, int *first, int *count)
+{
+	int i = stream->taken & 1;
+
+	pthread_mutex_lock (&stream->lock);
+	if (stream->taken > 0) {
+		stream->count[i ^ 1] = -1;
+		pthread_cond_broadcast (&stream->cond);
+	}
+	if (stream->first + (size_t) stream->taken * stream->block >=
+	    stream->end) {
+		pthread_mutex_unlock (&stream->lock);
+		return NULL;
+	}
+	while (stream->count[i] < 0)
+		pthread_cond_wait (&stream->cond, &stream->lock);
+	pthread_mutex_unlock (&stream->lock);
+
+	*first = stream->first + stream->taken * stream->block;
+	*count = stream->count[i];
+	stream->taken++;
+	return stream->buf[i];
+}
+
+/**
+ * Stops streaming, whether or not all the blocks were taken, and frees
+ * the stream.  Returns 0, or -1 if a read failed.
+ */
+int rows_stream_end (row_stream_t * stream)
+{
+	int i, error;
+
+	// cut the range short, so the helper stops after any read under way
+	pthread_mutex_lock (&stream->lock);
+	stream->end = stream->first;
+	pthread_cond_broadcast (&stream->cond);
+	pthread_mutex_unlock (&stream->lock);
+	pthread_join (stream->thread, NULL);
+
+	error = stream->error;
+	for (i = 0; i < 2; i++)
+		free (stream->buf[i]);
+	pthread_mutex_destroy (&stream->lock);
+	pthread_cond_destroy (&stream->cond);
+	free (stream);
+	return (error) ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef _ROWS_H
+#define _ROWS_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "arff.h"
+
+/* A row file: the instance rows of an ARFF file as raw data_t cells, in
+ * instance order, followed by the packed header (see arff_pack_header).
+ * Rows are read from it in blocks rather than held in memory.
+ */
+
+typedef struct {
+	int fd;
+	arff_info_t *info;	/* the header; no instances */
+	size_t row_size;	/* bytes per row */
+} row_file_t;
+
+/* Reads a range of rows in blocks, sequentially, a helper thread filling
+ * one buffer while the caller works on the other.
+ */
+typedef struct {
+	row_file_t *file;
+	int first;		/* rows [first, end) */
+	int end;
+	int block;		/* rows per buffer */
+	data_t *buf[2];
+	int count[2];		/* rows in each buffer, or -1 while empty */
+	int taken;		/* blocks handed out so far */
+	int error;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} row_stream_t;
+
+int rows_convert (char *arff_filename, char *class_attribute_name,
+		  char *filename);
+row_file_t *rows_open (char *filename, char *class_attribute_name);
+int rows_read (row_file_t * file, int first, int count, data_t * buf);
+void rows_close (row_file_t * file);
+
+row_stream_t *rows_stream (row_file_t * file, int first, int end, int block);
+data_t *rows_next (row_stream_t * stream, int *first, int *count);
+int rows_stream_end (row_stream_t * stream);
+
+#endif
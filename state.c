@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "arff.h"
+#include "state.h"
+#include "util.h"
+
+/* The state file is a small header followed by the arrays of
+ * relief_state_t, raw, in the order declared.  It is meant to be read back
+ * by the same build on the same kind of machine.
+ */
+
+#define STATE_MAGIC	0x53464c52	/* "RLFS" */
+#define STATE_VERSION	1
+
+/* Array sizes of a state, in elements */
+#define SUMS_SIZE(s)	((size_t) (s)->num_classes * (s)->num_classes * \
+			 (s)->num_attributes)
+#define LISTS_SIZE(s)	((size_t) (s)->num_instances * (s)->num_classes * \
+			 (s)->knn)
+
+/* The bytes of a state file with this header, or 0 if more than limit */
+static size_t state_size (relief_state_t * state, size_t limit)
+{
+	double approx;
+
+	// in floating point first, so no product can overflow
+	approx = (double) state->num_classes * state->num_classes *
+		state->num_attributes * sizeof (double) +
+		(double) state->num_instances * state->num_classes *
+		state->knn * sizeof (neighbour_t) +
+		2.0 * state->num_attributes * sizeof (double);
+	if (approx > limit)
+		return 0;
+	return sizeof (int) * 10 + sizeof (uint64_t) +
+		sizeof (double) * 2 * state->num_attributes +
+		sizeof (double) * SUMS_SIZE (state) +
+		sizeof (neighbour_t) * LISTS_SIZE (state);
+}
+
+/**
+ * Reads a state written by write_state.  Returns NULL, with the error set
+ * (see get_last_error), if the file cannot be read or is not a state file.
+ */
+relief_state_t *read_state (char *filename)
+{
+	FILE *fp;
+	int header[10];
+	relief_state_t *state;
+	struct stat st;
+	size_t n;
+
+	fp = fopen (filename, "rb");
+	if (fp == NULL) {
+		set_last_error ("Could not open state file", 0);
+		return NULL;
+	}
+
+	if (fread (header, sizeof (int), 10, fp) != 10
+	    || header[0] != STATE_MAGIC || header[1] != STATE_VERSION) {
+		set_last_error ("Not a state file of this version", 0);
+		fclose (fp);
+		return NULL;
+	}
+
+	state = (relief_state_t *) calloc (1, sizeof (relief_state_t));
+	if (state == NULL) {
+		set_last_error ("Out of memory for the state", 0);
+		fclose (fp);
+		return NULL;
+	}
+	state->num_attributes = header[2];
+	state->class_index = header[3];
+	state->num_classes = header[4];
+	state->num_instances = header[5];
+	state->knn = header[6];
+	state->sigma = header[7];
+	state->weight_by_distance = header[8];
+	state->difference = header[9];
+
+	// the arrays' sizes come from the header, so it has to agree with
+	// the file before anything is allocated
+	if (state->num_attributes <= 0 || state->num_classes <= 0
+	    || state->num_instances <= 0 || state->knn <= 0
+	    || state->class_index < 0
+	    || state->class_index >= state->num_attributes) {
+		set_last_error ("Corrupt state file header", 0);
+		release_state (state);
+		fclose (fp);
+		return NULL;
+	}
+	if (fstat (fileno (fp), &st) != 0
+	    || state_size (state, st.st_size) != (size_t) st.st_size) {
+		set_last_error ("State file size does not match its header",
+				0);
+		release_state (state);
+		fclose (fp);
+		return NULL;
+	}
+
+	state->min = (double *) malloc_dbg (62, sizeof (double) *
+					    state->num_attributes);
+	state->max = (double *) malloc_dbg (63, sizeof (double) *
+					    state->num_attributes);
+	state->sums = (double *) malloc_dbg (64, sizeof (double) *
+					     SUMS_SIZE (state));
+	state->lists = (neighbour_t *) malloc_dbg (65, sizeof (neighbour_t) *
+						   LISTS_SIZE (state));
+	if (state->min == NULL || state->max == NULL || state->sums == NULL
+	    || state->lists == NULL) {
+		set_last_error ("Out of memory for the state", 0);
+		release_state (state);
+		fclose (fp);
+		return NULL;
+	}
+
+	n = fread (&state->checksum, sizeof (uint64_t), 1, fp);
+	n += fread (state->min, sizeof (double), state->num_attributes, fp);
+	n += fread (state->max, sizeof (double), state->num_attributes, fp);
+	n += fread (state->sums, sizeof (double), SUMS_SIZE (state), fp);
+	n += fread (state->lists, sizeof (neighbour_t), LISTS_SIZE (state),
+		    fp);
+	fclose (fp);
+
+	if (n != 1 + 2 * state->num_attributes + SUMS_SIZE (state) +
+	    LISTS_SIZE (state)) {
+		set_last_error ("Truncated state file", 0);
+		release_state (state);
+		return NULL;
+	}
+
+	return state;
+}
+
+/**
+ * Writes a state for read_state.  Returns 0 on success, else -1 with the
+ * error set.
+ */
+int write_state (relief_state_t * state, char *filename)
+{
+	FILE *fp;
+	int header[10];
+	int ok;
+
+	fp = fopen (filename, "wb");
+	if (fp == NULL) {
+		set_last_error ("Could not open state file for writing", 0);
+		return -1;
+	}
+
+	header[0] = STATE_MAGIC;
+	header[1] = STATE_VERSION;
+	header[2] = state->num_attributes;
+	header[3] = state->class_index;
+	header[4] = state->num_classes;
+	header[5] = state->num_instances;
+	header[6] = state->knn;
+	header[7] = state->sigma;
+	header[8] = state->weight_by_distance;
+	header[9] = state->difference;
+
+	ok = fwrite (header, sizeof (int), 10, fp) == 10
+		&& fwrite (&state->checksum, sizeof (uint64_t), 1, fp) == 1
+		&& fwrite (state->min, sizeof (double), state->num_attributes,
+			   fp) == state->num_attributes
+		&& fwrite (state->max, sizeof (double), state->num_attributes,
+			   fp) == state->num_attributes
+		&& fwrite (state->sums, sizeof (double), SUMS_SIZE (state),
+			   fp) == SUMS_SIZE (state)
+		&& fwrite (state->lists, sizeof (neighbour_t),
+			   LISTS_SIZE (state), fp) == LISTS_SIZE (state);
+
+	if (fclose (fp) != 0 || !ok) {
+		set_last_error ("Could not write state file", 0);
+		return -1;
+	}
+	return 0;
+}
+
+void release_state (relief_state_t * state)
+{
+	if (state == NULL)
+		return;
+
+	free (state->min);
+	free (state->max);
+	free (state->sums);
+	free (state->lists);
+	free (state);
+}
+
+/**
+ * FNV-1a over the rows of the first count instances, to tell whether a
+ * state still describes the start of a dataset.
+ */
+uint64_t state_checksum (arff_info_t * info, int count)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	unsigned char *p;
+	size_t i, len = sizeof (data_t) * info->num_attributes;
+	int j;
+
+	for (j = 0; j < count; j++) {
+		p = (unsigned char *) info->instances[j]->data;
+		for (i = 0; i < len; i++) {
+			hash = (hash ^ p[i]) * 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
@@ -0,0 +1,47 @@
+#ifndef _STATE_H
+#define _STATE_H
+
+#include <stdint.h>
+#include "arff.h"
+
+/* A neighbour, as kept in sorted per-class lists */
+typedef struct {
+	double dist;
+	int index;		/* instance index, or -1 for an empty slot */
+} neighbour_t;
+
+/* Saved evaluator state, from which a run over the same instances plus
+ * some appended ones can be updated instead of recomputed.
+ */
+typedef struct {
+	/* the options and data shape the state was built with */
+	int num_attributes;
+	int class_index;
+	int num_classes;
+	int num_instances;
+	int knn;
+	int sigma;
+	int weight_by_distance;
+	int difference;
+	uint64_t checksum;	/* of the instances' rows, see state_checksum */
+
+	double *min;		/* numeric attribute ranges */
+	double *max;
+
+	/* Raw weight sums, per query class, neighbour class and attribute:
+	 * the weighted attribute differences to the neighbours, before the
+	 * sign and class prior factors.
+	 */
+	double *sums;
+
+	/* Per instance, per class, the knn nearest (see insertSorted) */
+	neighbour_t *lists;
+} relief_state_t;
+
+relief_state_t *read_state (char *filename);
+int write_state (relief_state_t * state, char *filename);
+void release_state (relief_state_t * state);
+
+uint64_t state_checksum (arff_info_t * info, int count);
+
+#endif
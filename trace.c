@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "arff.h"
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+#ifndef NO_MPI
+#include "mpi.h"
+#endif
+
+/* A span is kept whole, once it ends, as a Chrome "complete" event; the
+ * spans still open on a thread wait on a small stack of their start
+ * times.  Times are seconds from the origin, which every rank takes on
+ * leaving the same barrier, so the ranks' timelines line up to within
+ * the barrier's skew.
+ */
+
+static const char *span_names[NUM_SPANS] = {
+	"read", "minmax", "search", "update", "reduce", "rank", "output",
+	"batch", "block"
+};
+
+typedef struct {
+	double start;		/* seconds from the origin */
+	double length;
+	int span;
+	int tid;
+} trace_event_t;
+
+typedef struct trace_ring {
+	struct trace_ring *next;	/* the ring of the thread before */
+	int tid;
+	unsigned long head;	/* spans ever kept; the latest at head - 1 */
+	trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+static int tracing;
+static double origin;
+static trace_ring_t *rings;	/* every thread's, the latest first */
+static int threads;
+
+static __thread trace_ring_t *ring;
+static __thread double open_at[TRACE_DEPTH];
+static __thread int depth;
+
+/**
+ * Starts tracing; every rank must call it, before any other threads
+ * start.
+ */
+void trace_enable (void)
+{
+#ifndef NO_MPI
+	MPI_Barrier (MPI_COMM_WORLD);
+#endif
+	origin = metrics_now ();
+	tracing = 1;
+}
+
+/* The calling thread's ring, made and added to the list on first use */
+static trace_ring_t *thread_ring (void)
+{
+	trace_ring_t *r;
+
+	r = (trace_ring_t *) malloc_dbg (153, sizeof (trace_ring_t));
+	r->tid = __atomic_fetch_add (&threads, 1, __ATOMIC_RELAXED);
+	r->head = 0;
+	r->next = __atomic_load_n (&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&rings, &r->next, r, 1,
+					     __ATOMIC_RELEASE,
+					     __ATOMIC_RELAXED));
+	return r;
+}
+
+void trace_begin (trace_span_t span)
+{
+	if (!tracing)
+		return;
+	if (depth < TRACE_DEPTH)
+		open_at[depth] = metrics_now () - origin;
+	depth++;
+}
+
+void trace_end (trace_span_t span)
+{
+	trace_event_t *e;
+	double now;
+
+	if (!tracing || depth == 0)
+		return;
+	now = metrics_now () - origin;
+	if (--depth >= TRACE_DEPTH)
+		return;
+
+	if (ring == NULL)
+		ring = thread_ring ();
+	e = &ring->events[ring->head % TRACE_EVENTS];
+	e->start = open_at[depth];
+	e->length = now - open_at[depth];
+	e->span = span;
+	e->tid = ring->tid;
+	ring->head++;
+}
+
+/* Copies every thread's spans into one array; returns how many */
+static int collect (trace_event_t ** events)
+{
+	trace_ring_t *r;
+	unsigned long first, i;
+	int n = 0;
+
+	for (r = rings; r != NULL; r = r->next)
+		n += (r->head < TRACE_EVENTS) ? r->head : TRACE_EVENTS;
+	*events = (trace_event_t *) malloc_dbg (154, sizeof (trace_event_t) *
+						(n + 1));
+	n = 0;
+	for (r = rings; r != NULL; r = r->next) {
+		first = (r->head > TRACE_EVENTS) ? r->head - TRACE_EVENTS : 0;
+		for (i = first; i < r->head; i++)
+			(*events)[n++] = r->events[i % TRACE_EVENTS];
+	}
+	return n;
+}
+
+/**
+ * Gathers every rank's spans onto rank 0, which writes them to the named
+ * file as one trace, a process per rank and a thread per thread; every
+ * rank must call it, once its other threads are done.  Returns 0, or -1
+ * with the error set (see get_last_error) if the file cannot be written.
+ */
+int trace_write (char *filename)
+{
+	trace_event_t *mine, *all;
+	trace_ring_t *r, *next;
+	int me = 0, ranks = 1, n, p, i, k, r0 = 0;
+	int *counts, *displs;
+	FILE *fp;
+
+	n = collect (&mine);
+	for (r = rings; r != NULL; r = next) {
+		next = r->next;
+		free (r);
+	}
+	rings = NULL;
+	ring = NULL;
+	tracing = 0;
+
+#ifndef NO_MPI
+	MPI_Comm_rank (MPI_COMM_WORLD, &me);
+	MPI_Comm_size (MPI_COMM_WORLD, &ranks);
+#endif
+	counts = (int *) malloc_dbg (155, sizeof (int) * ranks);
+	displs = (int *) malloc_dbg (156, sizeof (int) * ranks);
+	k = n * (int) sizeof (trace_event_t);
+#ifdef NO_MPI
+	counts[0] = k;
+#else
+	MPI_Gather (&k, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#endif
+	for (p = 0, k = 0; me == 0 && p < ranks; p++) {
+		displs[p] = k;
+		k += counts[p];
+	}
+	all = (me == 0) ? (trace_event_t *) malloc_dbg (157, k + 1) : NULL;
+#ifdef NO_MPI
+	memcpy (all, mine, k);
+#else
+	MPI_Gatherv (mine, n * (int) sizeof (trace_event_t), MPI_BYTE, all,
+		     counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+#endif
+	free (mine);
+
+	if (me == 0) {
+		fp = fopen (filename, "w");
+		if (fp == NULL) {
+			set_last_error ("Could not open trace file for writing",
+					0);
+			r0 = -1;
+		} else {
+			fprintf (fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+			for (p = 0; p < ranks; p++)
+				fprintf (fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}},\n",
+					 p, p);
+			for (p = 0; p < ranks; p++) {
+				trace_event_t *e = (trace_event_t *)
+					((char *) all + displs[p]);
+
+				k = counts[p] / sizeof (trace_event_t);
+				for (i = 0; i < k; i++)
+					fprintf (fp, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f},\n",
+						 span_names[e[i].span], p,
+						 e[i].tid, e[i].start * 1e6,
+						 e[i].length * 1e6);
+			}
+			// a last event, as JSON allows no trailing comma
+			fprintf (fp, "{\"name\": \"end\", \"ph\": \"i\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"s\": \"g\"}\n]}\n",
+				 (metrics_now () - origin) * 1e6);
+			if (ferror (fp))
+				r0 = -1;
+			if (fclose (fp) != 0)
+				r0 = -1;
+			if (r0 != 0)
+				set_last_error ("Could not write trace file", 0);
+		}
+	}
+	free (all);
+	free (counts);
+	free (displs);
+	return r0;
+}
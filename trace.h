@@ -0,0 +1,38 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/* Event tracing: spans of time on every rank and thread, for a timeline
+ * in the Chrome trace format (chrome://tracing, Perfetto).  Each thread
+ * keeps its spans in a ring of its own, so recording takes no lock; a
+ * full ring drops its oldest spans.  Until trace_enable, a span costs a
+ * test and nothing else.
+ */
+
+/* The spans: the metrics phases, in their order (see metrics_phase_t),
+ * then the others
+ */
+typedef enum {
+	SPAN_READ,
+	SPAN_MINMAX,
+	SPAN_SEARCH,
+	SPAN_UPDATE,
+	SPAN_REDUCE,
+	SPAN_RANK,
+	SPAN_OUTPUT,
+	SPAN_BATCH,		/* queries between convergence checks */
+	SPAN_BLOCK,		/* a block of rows read from a row file */
+	NUM_SPANS
+} trace_span_t;
+
+/* Spans kept per thread */
+#define TRACE_EVENTS	(1 << 18)
+
+/* Spans open at once per thread */
+#define TRACE_DEPTH	16
+
+void trace_enable (void);
+void trace_begin (trace_span_t span);
+void trace_end (trace_span_t span);
+int trace_write (char *filename);
+
+#endif
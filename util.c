@@ -6,9 +6,9 @@
 #if 0
 
 /* #ifdef NO_MPI */
-void *malloc_dbg (int n, int x)
+void *malloc_dbg (int n, size_t x)
 {
-	printf ("%d Allocating %d bytes... ", n, x);
+	printf ("%d Allocating %zu bytes... ", n, x);
 	void *tmp = malloc (x);
 	if (tmp) {
 		printf ("SUCCESS\n");
@@ -21,7 +21,7 @@ void *malloc_dbg (int n, int x)
 	return tmp;
 }
 #else
-void *malloc_dbg (int n, int x)
+void *malloc_dbg (int n, size_t x)
 {
 	return malloc (x);
 }
@@ -44,3 +44,34 @@ int *remove_int (int *array, int len, int elem)
 		(len - skip - 1) * sizeof (int));
 	return ret;
 }
+
+/* The number of the first k entries of a that are among the first k of b */
+int topk_overlap (int *a, int *b, int k)
+{
+	int i, j, common = 0;
+
+	for (i = 0; i < k; i++) {
+		for (j = 0; j < k && b[j] != a[i]; j++);
+		if (j < k)
+			common++;
+	}
+	return common;
+}
+
+/* Spearman's correlation of two rankings of n items without ties, given
+ * as the rank of each item
+ */
+double spearman (int *a, int *b, int n)
+{
+	int i;
+	double d, sum = 0;
+
+	if (n < 2)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		d = a[i] - b[i];
+		sum += d * d;
+	}
+	return 1 - 6 * sum / ((double) n * ((double) n * n - 1));
+}
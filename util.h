@@ -1,8 +1,13 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
-void *malloc_dbg(int, int);
+#include <stddef.h>
+
+void *malloc_dbg(int, size_t);
 
 int *remove_int(int *, int, int);
 
+int topk_overlap(int *, int *, int);
+double spearman(int *, int *, int);
+
 #endif
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "rng.h"
+#include "util.h"
+#include "vptree.h"
+
+/* Instances per leaf, at most */
+#define VP_LEAF		8
+
+/* A child is skipped only when its bound exceeds the search radius by more
+ * than rounding could account for, so the search stays exact.
+ */
+#define VP_SLACK	1e-9
+
+typedef struct {
+	double dist;
+	int item;
+} vp_pair_t;
+
+typedef struct {
+	vp_tree_t *tree;
+	vp_pair_t *pairs;
+	uint64_t key;
+	uint64_t stream;
+} vp_build_t;
+
+static int comppair (const void *p1, const void *p2)
+{
+	const vp_pair_t *a = (const vp_pair_t *) p1;
+	const vp_pair_t *b = (const vp_pair_t *) p2;
+
+	if (a->dist != b->dist)
+		return (a->dist < b->dist) ? -1 : 1;
+	return (a->item < b->item) ? -1 : (a->item > b->item);
+}
+
+/* Builds the subtree over items [lo, hi), returning its node */
+static int build (vp_build_t * b, int lo, int hi)
+{
+	vp_tree_t *tree = b->tree;
+	vp_node_t *node;
+	int id = tree->num_nodes++, i, v, mid, *items = tree->items;
+
+	node = tree->nodes + id;
+	node->first = lo;
+	node->count = hi - lo;
+	node->inside = node->outside = -1;
+	if (hi - lo <= VP_LEAF) {
+		node->vp = -1;
+		return id;
+	}
+
+	// a random vantage point, the rest split at the median distance
+	v = lo + rng_below (b->key, b->stream, id, hi - lo);
+	node->vp = items[v];
+	items[v] = items[lo];
+	items[lo] = node->vp;
+	for (i = lo + 1; i < hi; i++) {
+		b->pairs[i].dist = tree->distance (node->vp, items[i],
+						   tree->arg);
+		b->pairs[i].item = items[i];
+	}
+	tree->built += hi - lo - 1;
+	qsort (b->pairs + lo + 1, hi - lo - 1, sizeof (vp_pair_t), comppair);
+	for (i = lo + 1; i < hi; i++) {
+		items[i] = b->pairs[i].item;
+	}
+
+	mid = lo + 1 + (hi - lo - 1) / 2;
+	node->bounds[0] = b->pairs[lo + 1].dist;
+	node->bounds[1] = b->pairs[mid - 1].dist;
+	node->bounds[2] = b->pairs[mid].dist;
+	node->bounds[3] = b->pairs[hi - 1].dist;
+
+	node->inside = build (b, lo + 1, mid);
+	node->outside = build (b, mid, hi);
+	return id;
+}
+
+/**
+ * Builds a tree over count instances, choosing vantage points with the
+ * given random key and stream, so every rank builds the same tree.
+ */
+vp_tree_t *vp_build (int *items, int count, vp_distance_t distance,
+		     void *arg, uint64_t key, uint64_t stream)
+{
+	vp_tree_t *tree;
+	vp_build_t b;
+
+	tree = (vp_tree_t *) malloc_dbg (138, sizeof (vp_tree_t));
+	tree->items = (int *) malloc_dbg (139, sizeof (int) * (count + 1));
+	tree->nodes = (vp_node_t *) malloc_dbg (140, sizeof (vp_node_t) *
+						(count + 1));
+	memcpy (tree->items, items, sizeof (int) * count);
+	tree->num_nodes = 0;
+	tree->distance = distance;
+	tree->arg = arg;
+	tree->built = tree->visited = tree->computed = 0;
+
+	b.tree = tree;
+	b.pairs = (vp_pair_t *) malloc_dbg (141, sizeof (vp_pair_t) *
+					    (count + 1));
+	b.key = key;
+	b.stream = stream;
+	build (&b, 0, count);
+	free (b.pairs);
+	return tree;
+}
+
+/* The least distance from a query at d from a vantage point to anything
+ * at distances [lo, hi] from it
+ */
+static double lower_bound (double d, double lo, double hi)
+{
+	if (d < lo)
+		return lo - d;
+	if (d > hi)
+		return d - hi;
+	return 0;
+}
+
+static void search (vp_tree_t * tree, int id, int query, vp_offer_t offer,
+		    void *arg, double *radius)
+{
+	vp_node_t *node = tree->nodes + id;
+	int i, c, child[2];
+	double d, bound[2];
+
+	tree->visited++;
+	if (node->vp < 0) {
+		for (i = node->first; i < node->first + node->count; i++) {
+			if (tree->items[i] != query) {
+				d = tree->distance (query, tree->items[i],
+						    tree->arg);
+				*radius = offer (tree->items[i], d, arg);
+				tree->computed++;
+			}
+		}
+		return;
+	}
+
+	d = tree->distance (query, node->vp, tree->arg);
+	tree->computed++;
+	if (node->vp != query)
+		*radius = offer (node->vp, d, arg);
+
+	// the child the query falls in first
+	bound[0] = lower_bound (d, node->bounds[0], node->bounds[1]);
+	bound[1] = lower_bound (d, node->bounds[2], node->bounds[3]);
+	c = (bound[1] < bound[0]);
+	child[0] = node->inside;
+	child[1] = node->outside;
+
+	for (i = 0; i < 2; i++, c ^= 1) {
+		if (*radius == DBL_MAX || bound[c] - *radius <=
+		    VP_SLACK * (1 + *radius))
+			search (tree, child[c], query, offer, arg, radius);
+	}
+}
+
+/**
+ * Offers every instance in the tree that could be within the search
+ * radius of the query, except the query itself, nearest subtrees first.
+ * Anything skipped is farther than the radius when it is skipped.
+ */
+void vp_search (vp_tree_t * tree, int query, vp_offer_t offer, void *arg)
+{
+	double radius = DBL_MAX;
+
+	if (tree->num_nodes > 0)
+		search (tree, 0, query, offer, arg, &radius);
+}
+
+void vp_release (vp_tree_t * tree)
+{
+	if (tree == NULL)
+		return;
+
+	free (tree->items);
+	free (tree->nodes);
+	free (tree);
+}
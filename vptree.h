@@ -0,0 +1,46 @@
+#ifndef _VPTREE_H
+#define _VPTREE_H
+
+#include <stdint.h>
+
+/* A vantage-point tree over instances, for exact nearest neighbour search
+ * under any metric: each node splits the instances below it by their
+ * distance to its vantage point, so the triangle inequality bounds the
+ * distance from a query to everything in a child.  Small sets are kept as
+ * leaves and scanned.
+ */
+
+/* The distance between instances a and b */
+typedef double (*vp_distance_t) (int a, int b, void *arg);
+
+/* Offers an instance at its distance from the query; returns the distance
+ * beyond which nothing more is wanted (the search radius).
+ */
+typedef double (*vp_offer_t) (int index, double dist, void *arg);
+
+typedef struct {
+	int vp;			/* the vantage point, or -1 for a leaf */
+	int first;		/* a leaf's instances, in the tree's items */
+	int count;
+	int inside;		/* children: nearer and farther than the split */
+	int outside;
+	double bounds[4];	/* least and greatest distance from vp in each */
+} vp_node_t;
+
+typedef struct {
+	int *items;
+	vp_node_t *nodes;
+	int num_nodes;
+	vp_distance_t distance;
+	void *arg;
+	double built;		/* distances computed building the tree */
+	double visited;		/* nodes visited searching it */
+	double computed;	/* distances computed searching it */
+} vp_tree_t;
+
+vp_tree_t *vp_build (int *items, int count, vp_distance_t distance,
+		     void *arg, uint64_t key, uint64_t stream);
+void vp_search (vp_tree_t * tree, int query, vp_offer_t offer, void *arg);
+void vp_release (vp_tree_t * tree);
+
+#endif